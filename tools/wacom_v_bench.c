@@ -0,0 +1,343 @@
+/*
+ * Userspace replay benchmark for the Wacom protocol 5 packet decoder.
+ *
+ * Feeds a packet stream through the very same decoder that is built into
+ * the kernel module (wacom_serial5_core.c) and reports the time spent per
+ * packet and the number of input events generated per packet.
+ *
+ * The stream is either a raw dump of the serial line (eg. captured with
+ * "cat /dev/ttyS0 > dump" while the tablet was in protocol 5 mode, or
+ * generated by the -w option) or a synthetic stream of a stylus and a 4D
+ * mouse moving around on both channels.
+ *
+ * With -t, the stream is fed to several emulated tablets at once, each
+ * with its own thumbwheel configuration and starting at a different point
+ * of the stream, byte by byte in turn like the interrupts of a multi-port
+ * serial card would. Every tablet has to produce exactly the same events
+ * as it does on its own, otherwise there is state shared between them.
+ *
+ * Build with "make bench" from the top level directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "wacom_serial5_core.h"
+#include "wacom_v_encode.h"
+
+struct stream {
+	unsigned char *data;
+	size_t len;
+	size_t npackets;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-n packets] [-c channels] [-r repeat] [-t tablets] [-f] [-s] "
+		"[-w dump] [stream]\n"
+		"  -n packets  number of synthetic packets (default 100000)\n"
+		"  -c channels 1: stylus only, 2: stylus and 4D mouse "
+		"(default 2)\n"
+		"  -r repeat   number of passes over the stream (default 10)\n"
+		"  -t tablets  check for cross-talk between this many tablets\n"
+		"  -f          filter and predict positions\n"
+		"  -s          one input device per channel (split_channels)\n"
+		"  -w dump     write the synthetic stream to dump and exit\n"
+		"  stream      replay a raw serial dump instead\n", prog);
+	exit(1);
+}
+
+/* A pen stroke on channel 0 and, with two channels, a 4D mouse on channel
+ * 1, each leaving and re-entering proximity every now and then. */
+static void make_synthetic(struct stream *s, size_t npackets, int nchannels)
+{
+	unsigned char *p;
+	size_t i;
+	int t;
+
+	s->len = npackets * PACKET_LENGTH;
+	s->npackets = npackets;
+	s->data = malloc(s->len);
+	if (!s->data) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0, p = s->data; i < npackets; i++, p += PACKET_LENGTH) {
+		int channel = nchannels > 1 ? i & 1 : 0;
+		t = nchannels > 1 ? i >> 1 : i;
+
+		if (t % 1000 == 0)
+			encode_device_id(p, channel,
+					 channel ? 0x094 : 0x822,
+					 0x1234567 + channel);
+		else if (t % 1000 == 999)
+			encode_out_of_proximity(p, channel);
+		else if (channel == 0)
+			encode_stylus(p, 0, 1000 + t % 20000,
+				      2000 + (t * 3) % 15000,
+				      t % (MAX_Z + 1), t & 0x06,
+				      t % 64, (t / 2) % 64);
+		else if (t & 1)
+			encode_mouse_4d(p, 1, 5000 + t % 10000,
+					5000 + t % 9000,
+					(t % 2047) - 1023, (t >> 4) & 0x7f);
+		else
+			encode_mouse_4d_rotation(p, 1, 5000 + t % 10000,
+						 5000 + t % 9000, t % 1800);
+	}
+}
+
+static void read_dump(struct stream *s, const char *path)
+{
+	FILE *f;
+	size_t cap = 1 << 16, n;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	s->len = 0;
+	s->data = malloc(cap);
+	while (s->data && (n = fread(s->data + s->len, 1,
+				     cap - s->len, f)) > 0) {
+		s->len += n;
+		if (s->len == cap)
+			s->data = realloc(s->data, cap *= 2);
+	}
+	if (!s->data) {
+		perror("malloc");
+		exit(1);
+	}
+	fclose(f);
+}
+
+/* Runs the stream through the same framer as wacom_interrupt. Command
+ * responses and line noise are skipped. Returns the number of packets
+ * decoded. */
+static size_t replay(struct wacom_v_decoder *dec, const struct stream *s,
+		     unsigned long long *nevents, unsigned long long *nunknown)
+{
+	struct wacom_v_framer fr;
+	struct wacom_v_frame frame;
+	size_t i, npackets = 0;
+
+	wacom_v_framer_init(&fr);
+
+	for (i = 0; i < s->len; i++) {
+		if (wacom_v_framer_feed(&fr, s->data[i], 0) != WACOM_V_PACKET)
+			continue;
+
+		npackets++;
+		switch (wacom_v_decode_packet(dec, fr.data, &frame)) {
+		case WACOM_V_FRAME:
+			*nevents += frame.nevents + 1; /* + SYN_REPORT */
+			break;
+		case WACOM_V_UNKNOWN:
+			(*nunknown)++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return npackets;
+}
+
+struct tablet {
+	struct wacom_v_params params;
+	struct wacom_v_framer fr;
+	struct wacom_v_decoder dec;
+	size_t pos;			/* next byte of the stream */
+	unsigned long long hash;	/* of all events so far */
+};
+
+static void tablet_init(struct tablet *t, int n, const struct stream *s)
+{
+	memset(t, 0, sizeof(*t));
+	t->params.pos_delay = 800 + 100 * n;
+	t->params.neg_delay = -(400 + 50 * n);
+	t->params.deadband = (n % 4) * 8;
+	t->params.thumbwheel_offset = n % 3;
+	wacom_v_framer_init(&t->fr);
+	wacom_v_decoder_init(&t->dec, &t->params);
+	t->pos = s->len ? (size_t)n * 37 * PACKET_LENGTH % s->len : 0;
+	t->hash = 14695981039346656037ULL; /* FNV-1a */
+}
+
+static void hash_int(unsigned long long *hash, int v)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, v >>= 8) {
+		*hash ^= v & 0xff;
+		*hash *= 1099511628211ULL;
+	}
+}
+
+static void tablet_feed(struct tablet *t, const struct stream *s)
+{
+	struct wacom_v_frame frame;
+	int i;
+
+	if (wacom_v_framer_feed(&t->fr, s->data[t->pos], 0) == WACOM_V_PACKET &&
+	    wacom_v_decode_packet(&t->dec, t->fr.data, &frame) == WACOM_V_FRAME)
+		for (i = 0; i < frame.nevents; i++) {
+			hash_int(&t->hash, frame.events[i].type);
+			hash_int(&t->hash, frame.events[i].code);
+			hash_int(&t->hash, frame.events[i].value);
+		}
+
+	if (++t->pos == s->len)
+		t->pos = 0;
+}
+
+/* Feeds every tablet the whole stream (repeat times) on its own and then
+ * all of them interleaved, and compares the events. Returns the number
+ * of tablets that differ. */
+static int crosstalk(const struct stream *s, int ntablets, int repeat)
+{
+	struct tablet *t;
+	unsigned long long *solo;
+	size_t i, nbytes = s->len * repeat;
+	int n, bad = 0;
+
+	t = calloc(ntablets, sizeof(*t));
+	solo = calloc(ntablets, sizeof(*solo));
+	if (!t || !solo) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (n = 0; n < ntablets; n++) {
+		tablet_init(&t[n], n, s);
+		for (i = 0; i < nbytes; i++)
+			tablet_feed(&t[n], s);
+		solo[n] = t[n].hash;
+	}
+
+	for (n = 0; n < ntablets; n++)
+		tablet_init(&t[n], n, s);
+	for (i = 0; i < nbytes; i++)
+		for (n = 0; n < ntablets; n++)
+			tablet_feed(&t[n], s);
+
+	for (n = 0; n < ntablets; n++)
+		if (t[n].hash != solo[n]) {
+			printf("tablet %d: events differ from its solo run\n",
+			       n);
+			bad++;
+		}
+	printf("tablets:         %d\n", ntablets);
+	printf("cross-talk:      %s\n", bad ? "YES" : "none");
+
+	free(solo);
+	free(t);
+	return bad;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	struct wacom_v_params params = {
+		.pos_delay = 800,
+		.neg_delay = -800,
+		.filter_alpha = 128,
+		.filter_beta = 43,
+		.predict = 100,
+	};
+	struct wacom_v_decoder dec;
+	struct stream s;
+	unsigned long long nevents = 0, nunknown = 0, npackets = 0;
+	size_t nsynthetic = 100000;
+	const char *dump = NULL;
+	int repeat = 10, nchannels = 2, ntablets = 0, split = 0, opt, i;
+	double start, elapsed;
+
+	while ((opt = getopt(argc, argv, "n:c:r:t:fsw:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nsynthetic = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			nchannels = atoi(optarg);
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 't':
+			ntablets = atoi(optarg);
+			break;
+		case 'f':
+			params.filter = 1;
+			break;
+		case 's':
+			split = 1;
+			break;
+		case 'w':
+			dump = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc)
+		read_dump(&s, argv[optind]);
+	else
+		make_synthetic(&s, nsynthetic, nchannels);
+
+	if (dump) {
+		FILE *f = fopen(dump, "wb");
+		if (!f || fwrite(s.data, 1, s.len, f) != s.len) {
+			perror(dump);
+			return 1;
+		}
+		fclose(f);
+		return 0;
+	}
+
+	if (ntablets > 0) {
+		i = crosstalk(&s, ntablets, repeat);
+		free(s.data);
+		return i ? 1 : 0;
+	}
+
+	wacom_v_decoder_init(&dec, &params);
+	dec.separate_devices = split;
+
+	start = now_ns();
+	for (i = 0; i < repeat; i++)
+		npackets += replay(&dec, &s, &nevents, &nunknown);
+	elapsed = now_ns() - start;
+
+	if (!npackets) {
+		fprintf(stderr, "No packets in stream.\n");
+		return 1;
+	}
+
+	printf("packets:         %llu\n", npackets);
+	printf("unknown packets: %llu\n", nunknown);
+	printf("events:          %llu\n", nevents);
+	printf("ns/packet:       %.2f\n", elapsed / npackets);
+	printf("events/packet:   %.2f\n", (double)nevents / npackets);
+	for (i = 0; i < PACKET_NUM_TYPES; i++)
+		printf("  %-16s %lu\n", wacom_v_packet_type_names[i],
+		       dec.packets[i]);
+
+	free(s.data);
+	return 0;
+}
@@ -0,0 +1,687 @@
+/*
+ * End-to-end latency benchmark for the Wacom protocol 5 driver, without a
+ * tablet.
+ *
+ * Emulates a tablet on the master side of a pty and attaches the slave
+ * side to the driver like inputattach does (serport line discipline,
+ * SERIO_WACOM_V), or with -l through the driver's own line discipline
+ * (see the ldisc module parameter). The emulator answers the requests the driver sends
+ * while setting up the tablet, then streams packets at a fixed rate once
+ * the driver starts the tablet. Meanwhile the input devices of the driver
+ * are read, and every X coordinate is matched back to the packet that
+ * carried it: each packet gets a different X. That gives the latency from
+ * writing a packet to the pty to reading its events from evdev, the
+ * number of packets that never made it, and the throughput. The kernel
+ * CPU time per packet (of the whole machine, so keep it otherwise idle)
+ * compares the two ways into the driver with the same stream.
+ *
+ * With -c, nothing is streamed. Instead the driver is bound to the port
+ * again, so it brings the tablet up from its cached profile, a setting
+ * is changed through sysfs and the tablet's new configuration string has
+ * to show up in the configuration attribute without the driver probing
+ * the tablet again.
+ *
+ * Needs root and the driver loaded. Leave the driver's filter and
+ * coalesce_us at 0, or positions won't match up (with coalescing, merged
+ * packets count as dropped).
+ *
+ * Build with "make emu" from the top level directory.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/serio.h>
+#include <linux/tty.h>
+
+#include "wacom_serial5_core.h"
+#include "wacom_v_encode.h"
+
+#ifndef SERIO_WACOM_V
+#define SERIO_WACOM_V 0x3e
+#endif
+
+#define DEVICE_NAME	"Wacom protocol 5 serial tablet"
+#define MAX_X		30480
+#define MAX_Y		24060
+#define X_BASE		100
+#define X_RANGE		30000	/* distinct X values, see packet_x() */
+#define MAX_DEVICES	4
+
+enum tools {
+	TOOLS_STYLUS,		/* stylus on channel 0 */
+	TOOLS_MOUSE,		/* 4D mouse on channel 0 */
+	TOOLS_LENS,		/* lens cursor on channel 0 */
+	TOOLS_MIXED,		/* stylus on 0, 4D mouse and lens on 1 */
+};
+
+static const char *const tool_names[] = {
+	[TOOLS_STYLUS] = "stylus",
+	[TOOLS_MOUSE] = "mouse",
+	[TOOLS_LENS] = "lens",
+	[TOOLS_MIXED] = "mixed",
+};
+
+static struct {
+	int rate;		/* packets per second */
+	int duration;		/* seconds */
+	int speed;		/* serio->id.extra, see link_speeds[] */
+	enum tools tools;
+	int ldisc;		/* line discipline to attach with */
+	int check_settings;	/* run the settings check instead */
+} opt = {
+	.rate = 200,
+	.duration = 10,
+	.speed = 3,
+	.tools = TOOLS_MIXED,
+	.ldisc = N_MOUSE,
+};
+
+static int master, slave;
+
+/* Indexed by X - X_BASE: when the packet with that X was written, 0 if it
+ * was received (or never sent) */
+static long long sent_ns[X_RANGE];
+static pthread_mutex_t sent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long nsent, nreceived, nevents;
+static long long *latencies, *stamp_errors;
+static size_t nlatencies;
+
+static volatile int streaming, done;
+
+/* The emulated tablet's report interval (IT command), part of its
+ * configuration string */
+static int interval = 2;
+static unsigned long long model_requests;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-r rate] [-d seconds] [-s speed] "
+		"[-t stylus|mouse|lens|mixed] [-l ldisc] [-c]\n"
+		"  -r rate     packets per second (default 200)\n"
+		"  -d seconds  how long to stream (default 10)\n"
+		"  -s speed    link speed passed to the driver, 0-3 "
+		"(default 3, 38400)\n"
+		"  -t tools    what to emulate (default mixed: a stylus and "
+		"a 4D mouse\n"
+		"              taking turns with a lens cursor)\n"
+		"  -l ldisc    attach with this line discipline instead of "
+		"serport (N_MOUSE),\n"
+		"              the number the driver's ldisc parameter was "
+		"given\n"
+		"  -c          check that a setting changed on a tablet set up "
+		"from its\n"
+		"              cached profile shows up in its configuration\n",
+		prog);
+	exit(1);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void write_all(const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(master, p, len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			perror("write");
+			exit(1);
+		}
+		p += n;
+		len -= n;
+	}
+}
+
+/* The serport line discipline (and the driver's own) registers the serio
+ * port in read() and only returns from it once the tty goes away, like in
+ * inputattach. */
+static void *serport_thread(void *arg)
+{
+	unsigned long devt = SERIO_WACOM_V | ((unsigned long)opt.speed << 16);
+
+	if (ioctl(slave, TIOCSETD, &opt.ldisc) < 0 ||
+	    ioctl(slave, SPIOCSTYPE, &devt) < 0) {
+		perror("serport");
+		exit(1);
+	}
+	if (read(slave, NULL, 0) < 0)
+		perror("serport");
+	return NULL;
+}
+
+static void answer(const char *cmd)
+{
+	static const char model[] = "~#GD-1212-R00 V1.3-2\r";
+	static char coords[32], config[32];
+
+	if (!strncmp(cmd, "~#", 2)) {
+		model_requests++;
+		write_all(model, strlen(model));
+	} else if (!strncmp(cmd, "~C", 2)) {
+		snprintf(coords, sizeof(coords), "~C%u,%u\r", MAX_X, MAX_Y);
+		write_all(coords, strlen(coords));
+	} else if (!strncmp(cmd, "~R", 2)) {
+		snprintf(config, sizeof(config),
+			 "~RE202C900,002,%02d,1270,1270\r", interval);
+		write_all(config, strlen(config));
+	} else if (!strncmp(cmd, "IT", 2)) {
+		interval = atoi(cmd + 2);
+	} else if (!strcmp(cmd, "ST")) {
+		streaming = 1;
+	} else if (!strcmp(cmd, "SP")) {
+		streaming = 0;
+	}
+}
+
+/* Commands from the driver end in \r */
+static void read_commands(void)
+{
+	static char cmd[64];
+	static size_t len;
+	char buf[64];
+	ssize_t n, i;
+
+	n = read(master, buf, sizeof(buf));
+	for (i = 0; i < n; i++) {
+		if (buf[i] == '\r') {
+			cmd[len] = 0;
+			answer(cmd);
+			len = 0;
+		} else if (len < sizeof(cmd) - 1) {
+			cmd[len++] = buf[i];
+		}
+	}
+}
+
+/* Every packet gets an X of its own, so its events can be found again */
+static int packet_x(unsigned long long seq)
+{
+	return X_BASE + seq % X_RANGE;
+}
+
+static void send_packet(unsigned char *p, int x)
+{
+	pthread_mutex_lock(&sent_lock);
+	sent_ns[x - X_BASE] = now_ns();
+	nsent++;
+	pthread_mutex_unlock(&sent_lock);
+	write_all(p, PACKET_LENGTH);
+}
+
+/* Channel 1 swaps its tool every this many packets in mixed mode */
+#define SWAP_TOOL 500
+
+static void stream_packet(unsigned long long seq)
+{
+	unsigned char p[PACKET_LENGTH];
+	int x = packet_x(seq), y = 1000 + seq % 20000;
+	int channel = opt.tools == TOOLS_MIXED ? seq & 1 : 0;
+	unsigned long long t = opt.tools == TOOLS_MIXED ? seq >> 1 : seq;
+	enum tools tool = opt.tools;
+
+	if (opt.tools == TOOLS_MIXED)
+		tool = !channel ? TOOLS_STYLUS :
+		       (t / SWAP_TOOL) & 1 ? TOOLS_LENS : TOOLS_MOUSE;
+
+	if (t % SWAP_TOOL == 0) {
+		/* (re)enter proximity */
+		encode_out_of_proximity(p, channel);
+		write_all(p, PACKET_LENGTH);
+		encode_device_id(p, channel,
+				 tool == TOOLS_STYLUS ? 0x822 :
+				 tool == TOOLS_LENS ? 0x096 : 0x094,
+				 0x1000 + channel);
+		write_all(p, PACKET_LENGTH);
+	}
+
+	switch (tool) {
+	case TOOLS_STYLUS:
+		encode_stylus(p, channel, x, y, t % (MAX_Z + 1), 0,
+			      t % 64, (t / 2) % 64);
+		break;
+	case TOOLS_LENS:
+		encode_lens(p, channel, x, y, 0);
+		break;
+	default:
+		if (t & 1)
+			encode_mouse_4d_rotation(p, channel, x, y, t % 1800);
+		else
+			encode_mouse_4d(p, channel, x, y, 0, 0);
+		break;
+	}
+	send_packet(p, x);
+}
+
+static int open_devices(int *fds)
+{
+	glob_t g;
+	char name[256];
+	int clock = CLOCK_MONOTONIC;
+	size_t i;
+	int n = 0, fd;
+
+	if (glob("/dev/input/event*", 0, NULL, &g))
+		return 0;
+
+	for (i = 0; i < g.gl_pathc && n < MAX_DEVICES; i++) {
+		fd = open(g.gl_pathv[i], O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+		if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) < 0 ||
+		    strncmp(name, DEVICE_NAME, strlen(DEVICE_NAME))) {
+			close(fd);
+			continue;
+		}
+		ioctl(fd, EVIOCSCLOCKID, &clock);
+		fds[n++] = fd;
+	}
+	globfree(&g);
+	return n;
+}
+
+static void got_x(int x, long long received, long long stamp)
+{
+	long long sent;
+
+	if (x < X_BASE || x >= X_BASE + X_RANGE)
+		return;
+
+	pthread_mutex_lock(&sent_lock);
+	sent = sent_ns[x - X_BASE];
+	sent_ns[x - X_BASE] = 0;
+	pthread_mutex_unlock(&sent_lock);
+	if (!sent)
+		return;
+
+	nreceived++;
+	if (nlatencies < (size_t)opt.rate * opt.duration * 2) {
+		latencies[nlatencies] = received - sent;
+		stamp_errors[nlatencies] = stamp - sent;
+		nlatencies++;
+	}
+}
+
+static void *evdev_thread(void *arg)
+{
+	struct pollfd pfd[MAX_DEVICES];
+	struct input_event ev[64];
+	int fds[MAX_DEVICES], n, i, j;
+	int x[MAX_DEVICES] = { 0 };
+	ssize_t len;
+
+	while (!(n = open_devices(fds)) && !done)
+		usleep(10000);
+
+	for (i = 0; i < n; i++) {
+		pfd[i].fd = fds[i];
+		pfd[i].events = POLLIN;
+	}
+
+	while (!done) {
+		if (poll(pfd, n, 100) <= 0)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+			len = read(fds[i], ev, sizeof(ev));
+			for (j = 0; j < len / (ssize_t)sizeof(ev[0]); j++) {
+				nevents++;
+				if (ev[j].type == EV_ABS && ev[j].code == ABS_X)
+					x[i] = ev[j].value;
+				if (ev[j].type == EV_SYN &&
+				    ev[j].code == SYN_REPORT && x[i]) {
+					got_x(x[i], now_ns(),
+					      ev[j].input_event_sec *
+					      1000000000LL +
+					      ev[j].input_event_usec * 1000LL);
+					x[i] = 0;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		close(fds[i]);
+	return NULL;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Time all CPUs spent in the kernel so far (system, irq and softirq), in
+ * ns */
+static long long kernel_time(void)
+{
+	unsigned long long user, nice, system, idle, iowait, irq, softirq;
+	FILE *f = fopen("/proc/stat", "r");
+	int n;
+
+	if (!f)
+		return 0;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu", &user, &nice,
+		   &system, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+	if (n != 7)
+		return 0;
+	return (system + irq + softirq) * (1000000000LL / sysconf(_SC_CLK_TCK));
+}
+
+/* Answers the driver for ms milliseconds */
+static void answer_for(int ms)
+{
+	long long end = now_ns() + ms * 1000000LL;
+	struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+	while (now_ns() < end)
+		if (poll(&pfd, 1, 10) > 0)
+			read_commands();
+}
+
+/* Reads an attribute of the serio port, without the trailing newline */
+static int read_attr(const char *dir, const char *name, char *buf,
+		     size_t len)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\r'))
+		n--;
+	buf[n] = 0;
+	return 0;
+}
+
+static int write_attr(const char *dir, const char *name, const char *val)
+{
+	char path[PATH_MAX];
+	int fd, err;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	err = write(fd, val, strlen(val)) < 0;
+	close(fd);
+	return err ? -1 : 0;
+}
+
+/* Waits (answering the driver) until attribute name reads want */
+static int wait_attr(const char *dir, const char *name, const char *want,
+		     int ms)
+{
+	char buf[64];
+
+	for (; ms > 0; ms -= 100) {
+		if (!read_attr(dir, name, buf, sizeof(buf)) &&
+		    !strcmp(buf, want))
+			return 0;
+		answer_for(100);
+	}
+	return -1;
+}
+
+/* The serio port the driver registered last is ours */
+static int find_port(char *dir, size_t len)
+{
+	glob_t g;
+	size_t i;
+	int n, best = -1;
+
+	if (glob("/sys/bus/serio/devices/serio*/setup_state", 0, NULL, &g))
+		return -1;
+	for (i = 0; i < g.gl_pathc; i++)
+		if (sscanf(g.gl_pathv[i], "/sys/bus/serio/devices/serio%d",
+			   &n) == 1 && n > best)
+			best = n;
+	globfree(&g);
+	if (best < 0)
+		return -1;
+	snprintf(dir, len, "/sys/bus/serio/devices/serio%d", best);
+	return 0;
+}
+
+/* Brings the tablet up again from its cached profile, changes the report
+ * interval and checks that the configuration attribute follows and that
+ * the driver did not probe the tablet again for it. */
+static int check_settings(void)
+{
+	char dir[PATH_MAX], want[32], buf[64];
+	int fail = 0;
+
+	if (find_port(dir, sizeof(dir))) {
+		fprintf(stderr, "No serio port of the driver found\n");
+		return 1;
+	}
+
+	/* serio rebinds the driver in the background. Give it time to
+	 * get rid of the old one, which may have been cached as well. */
+	if (write_attr(dir, "drvctl", "rescan")) {
+		perror("drvctl");
+		return 1;
+	}
+	answer_for(500);
+	if (wait_attr(dir, "setup_state", "cached", 5000)) {
+		fprintf(stderr, "%s: not set up from the cached profile\n",
+			dir);
+		return 1;
+	}
+	/* Let the tablet confirm the profile */
+	answer_for(1000);
+
+	model_requests = 0;
+	if (write_attr(dir, "report_interval", "5")) {
+		perror("report_interval");
+		return 1;
+	}
+	snprintf(want, sizeof(want), "~RE202C900,002,%02d,1270,1270", 5);
+	if (wait_attr(dir, "configuration", want, 3000)) {
+		read_attr(dir, "configuration", buf, sizeof(buf));
+		printf("configuration:   %s, expected %s\n", buf, want);
+		fail = 1;
+	}
+	if (model_requests) {
+		printf("probed again:    %llu model requests\n",
+		       model_requests);
+		fail = 1;
+	}
+	if (read_attr(dir, "setup_state", buf, sizeof(buf)) ||
+	    strcmp(buf, "cached")) {
+		printf("setup_state:     %s, expected cached\n", buf);
+		fail = 1;
+	}
+	printf("settings check:  %s\n", fail ? "FAILED" : "ok");
+	return fail;
+}
+
+static double percentile(long long *v, size_t n, int p)
+{
+	if (!n)
+		return 0;
+	return v[(n - 1) * p / 100] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t serport, evdev;
+	struct termios tio;
+	unsigned long long seq = 0;
+	long long start, next, end, period, kernel_ns;
+	double elapsed;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:d:s:t:l:ch")) != -1) {
+		switch (c) {
+		case 'r':
+			opt.rate = atoi(optarg);
+			break;
+		case 'd':
+			opt.duration = atoi(optarg);
+			break;
+		case 's':
+			opt.speed = atoi(optarg);
+			break;
+		case 't':
+			for (opt.tools = 0; opt.tools <= TOOLS_MIXED;
+			     opt.tools++)
+				if (!strcmp(optarg, tool_names[opt.tools]))
+					break;
+			if (opt.tools > TOOLS_MIXED)
+				usage(argv[0]);
+			break;
+		case 'l':
+			opt.ldisc = atoi(optarg);
+			break;
+		case 'c':
+			opt.check_settings = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (opt.rate <= 0 || opt.duration <= 0)
+		usage(argv[0]);
+
+	latencies = calloc((size_t)opt.rate * opt.duration * 2,
+			   sizeof(*latencies));
+	stamp_errors = calloc((size_t)opt.rate * opt.duration * 2,
+			      sizeof(*stamp_errors));
+	if (!latencies || !stamp_errors) {
+		perror("malloc");
+		return 1;
+	}
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master)) {
+		perror("pty");
+		return 1;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+	if (slave < 0) {
+		perror(ptsname(master));
+		return 1;
+	}
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	pthread_create(&evdev, NULL, evdev_thread, NULL);
+	pthread_create(&serport, NULL, serport_thread, NULL);
+
+	/* Wait for the driver to set the tablet up */
+	start = now_ns();
+	while (!streaming) {
+		struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+		if (now_ns() - start > 10000000000LL) {
+			fprintf(stderr, "The driver never started the "
+				"tablet, is it loaded?\n");
+			return 1;
+		}
+		if (poll(&pfd, 1, 100) > 0)
+			read_commands();
+	}
+	printf("setup:           %.1f ms\n", (now_ns() - start) / 1e6);
+
+	if (opt.check_settings) {
+		c = check_settings();
+		done = 1;
+		pthread_join(evdev, NULL);
+		close(master);
+		pthread_join(serport, NULL);
+		close(slave);
+		return c;
+	}
+
+	/* Give evdev_thread a moment to find the input devices */
+	usleep(200000);
+
+	period = 1000000000LL / opt.rate;
+	kernel_ns = kernel_time();
+	start = next = now_ns();
+	end = start + opt.duration * 1000000000LL;
+	while (next < end) {
+		struct timespec ts = {
+			.tv_sec = next / 1000000000LL,
+			.tv_nsec = next % 1000000000LL,
+		};
+		struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if (poll(&pfd, 1, 0) > 0)
+			read_commands();
+		if (streaming)
+			stream_packet(seq++);
+		next += period;
+	}
+	elapsed = (now_ns() - start) / 1e9;
+	kernel_ns = kernel_time() - kernel_ns;
+
+	/* Let the last packets through */
+	usleep(200000);
+	done = 1;
+	pthread_join(evdev, NULL);
+
+	qsort(latencies, nlatencies, sizeof(*latencies), cmp_ll);
+	qsort(stamp_errors, nlatencies, sizeof(*stamp_errors), cmp_ll);
+
+	printf("packets sent:    %llu\n", nsent);
+	printf("packets seen:    %llu\n", nreceived);
+	printf("dropped:         %llu\n", nsent - nreceived);
+	printf("throughput:      %.1f packets/s, %.1f events/s\n",
+	       nreceived / elapsed, nevents / elapsed);
+	printf("latency (us):    p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+	       percentile(latencies, nlatencies, 50),
+	       percentile(latencies, nlatencies, 90),
+	       percentile(latencies, nlatencies, 99),
+	       percentile(latencies, nlatencies, 100));
+	printf("timestamp - write time (us): p1 %.1f  p50 %.1f  p99 %.1f\n",
+	       percentile(stamp_errors, nlatencies, 1),
+	       percentile(stamp_errors, nlatencies, 50),
+	       percentile(stamp_errors, nlatencies, 99));
+	if (nsent)
+		printf("kernel CPU:      %.2f us/packet\n",
+		       kernel_ns / 1e3 / nsent);
+
+	/* Hanging up detaches the driver and ends serport_thread */
+	close(master);
+	pthread_join(serport, NULL);
+	close(slave);
+	return 0;
+}
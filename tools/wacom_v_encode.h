@@ -0,0 +1,88 @@
+/*
+ * Packet encoders for the tools: the inverse of the bit fiddling in
+ * wacom_serial5_core.c
+ */
+
+#ifndef _WACOM_V_ENCODE_H
+#define _WACOM_V_ENCODE_H
+
+#include <string.h>
+
+#include "wacom_serial5_core.h"
+
+static inline void encode_position(unsigned char *p, int x, int y)
+{
+	p[1] = (x >> 9) & 0x7f;
+	p[2] = (x >> 2) & 0x7f;
+	p[3] = ((x & 0x03) << 5) | ((y >> 11) & 0x1f);
+	p[4] = (y >> 4) & 0x7f;
+	p[5] = (y & 0x0f) << 3;
+}
+
+static inline void encode_device_id(unsigned char *p, int channel, int tool_id,
+				    unsigned int serial)
+{
+	memset(p, 0, PACKET_LENGTH);
+	p[0] = 0xc0 | channel;
+	p[1] = (tool_id >> 5) & 0x7f;
+	p[2] = ((tool_id & 0x1f) << 2) | ((serial >> 30) & 0x03);
+	p[3] = (serial >> 23) & 0x7f;
+	p[4] = (serial >> 16) & 0x7f;
+	p[5] = (serial >>  9) & 0x7f;
+	p[6] = (serial >>  2) & 0x7f;
+	p[7] = (serial & 0x03) << 5;
+}
+
+static inline void encode_stylus(unsigned char *p, int channel, int x, int y,
+				 int z, int buttons, int tiltx, int tilty)
+{
+	memset(p, 0, PACKET_LENGTH);
+	p[0] = 0xa0 | PROXIMITY_BIT | (buttons & 0x06) | channel;
+	encode_position(p, x, y);
+	p[5] |= (z >> 7) & 0x07;
+	p[6] = z & 0x7f;
+	p[7] = tiltx & 0x7f;
+	p[8] = tilty & 0x7f;
+}
+
+static inline void encode_mouse_4d(unsigned char *p, int channel, int x, int y,
+				   int throttle, int buttons)
+{
+	memset(p, 0, PACKET_LENGTH);
+	p[0] = 0xa8 | PROXIMITY_BIT | channel;
+	encode_position(p, x, y);
+	if (throttle < 0) {
+		throttle = -throttle;
+		p[8] |= 0x08;
+	}
+	p[5] |= (throttle >> 7) & 0x07;
+	p[6] = throttle & 0x7f;
+	p[8] |= ((buttons << 1) & 0x70) | (buttons & 0x07);
+}
+
+static inline void encode_mouse_4d_rotation(unsigned char *p, int channel,
+					    int x, int y, int rotation)
+{
+	memset(p, 0, PACKET_LENGTH);
+	p[0] = 0xaa | PROXIMITY_BIT | channel;
+	encode_position(p, x, y);
+	p[6] = (rotation >> 7) & 0x0f;
+	p[7] = rotation & 0x7f;
+}
+
+static inline void encode_out_of_proximity(unsigned char *p, int channel)
+{
+	memset(p, 0, PACKET_LENGTH);
+	p[0] = 0x80 | channel;
+}
+
+static inline void encode_lens(unsigned char *p, int channel, int x, int y,
+			       int buttons)
+{
+	memset(p, 0, PACKET_LENGTH);
+	p[0] = 0xa8 | PROXIMITY_BIT | channel;
+	encode_position(p, x, y);
+	p[8] = buttons & 0x1f;
+}
+
+#endif /* _WACOM_V_ENCODE_H */
@@ -0,0 +1,503 @@
+/*
+ * Fuzzing and stress harness for the Wacom protocol 5 framer, response
+ * parser and packet decoder.
+ *
+ * Everything the tablet sends ends up in wacom_v_framer_feed(), and from
+ * there in wacom_v_parse_response() or wacom_v_decode_packet(). These are
+ * built from the very same wacom_serial5_core.c as the kernel module, so
+ * whatever is found here is found in the driver.
+ *
+ * The first byte of an input selects the configuration:
+ *	bit 0	filter and predict positions
+ *	bit 1	one input device per channel (split_channels)
+ *	bit 2	the rest of the input is (flags, data) pairs, bit 0 of flags
+ *		being a parity or framing error on that byte
+ *	bit 3	thumbwheel in absolute mode, with an offset
+ *	bit 4	pressure curves loaded for all styli
+ *	bit 5	an active area, rotated by 90 degrees and scaled
+ * Responses that parse are acted upon the way the driver does, so a "~C"
+ * response sets the coordinate range that later packets are checked
+ * against.
+ *
+ * Every packet and response is copied into a buffer of exactly its size
+ * before it is looked at, so with AddressSanitizer any read past the end
+ * is caught. Every event is checked against the range its axis was
+ * registered with in wacom_init_input_dev().
+ *
+ * "make libfuzzer" builds it for libFuzzer (needs clang), which then
+ * comes up with the inputs. "make fuzz" builds it with the sanitizers
+ * only; the inputs are read from the files given on the command line (a
+ * libFuzzer corpus, say) or, with -i, generated from mutated packet
+ * streams (DEFAULT_ITERATIONS of them if there are no files either).
+ * "make stress" builds it without the sanitizers, for -s: a stress test
+ * that measures the CPU time spent per byte and fails if any block of
+ * the stream took more than the budget given with -b.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "wacom_serial5_core.h"
+#include "wacom_v_encode.h"
+
+#define FUZZ_FILTER	0x01
+#define FUZZ_SPLIT	0x02
+#define FUZZ_FLAGS	0x04
+#define FUZZ_THROTTLE	0x08
+#define FUZZ_PRESSURE	0x10
+#define FUZZ_AREA	0x20
+
+struct harness {
+	struct wacom_v_params params;
+	struct wacom_v_framer fr;
+	struct wacom_v_decoder dec;
+	struct wacom_v_area area;
+	int max_x, max_y;
+	unsigned long packets, responses, events;
+};
+
+/* A soft curve that reaches MAX_Z early, like the ones users load */
+static struct wacom_v_pressure_lut soft_pressure;
+
+static void fail(const char *what, const struct wacom_v_event *ev)
+{
+	if (ev)
+		fprintf(stderr, "%s: type %d code %d value %d\n", what,
+			ev->type, ev->code, ev->value);
+	else
+		fprintf(stderr, "%s\n", what);
+	abort();
+}
+
+static void harness_init(struct harness *h, int config)
+{
+	memset(h, 0, sizeof(*h));
+	h->params.pos_delay = 800;
+	h->params.neg_delay = -800;
+	h->params.scroll_accel = 200;
+	h->params.filter = !!(config & FUZZ_FILTER);
+	h->params.filter_alpha = 128;
+	h->params.filter_beta = 43;
+	h->params.predict = 400;
+	if (config & FUZZ_THROTTLE) {
+		h->params.th_mode = 1;
+		h->params.thumbwheel_offset = -1023;
+	}
+	wacom_v_framer_init(&h->fr);
+	wacom_v_decoder_init(&h->dec, &h->params);
+	h->dec.separate_devices = !!(config & FUZZ_SPLIT);
+	h->max_x = h->max_y = 0xffff;
+	if (config & FUZZ_PRESSURE) {
+		int i;
+
+		for (i = 0; i <= MAX_Z; i++)
+			soft_pressure.z[i] = i < MAX_Z / 2 ? 2 * i : MAX_Z;
+		for (i = 0; i < WACOM_V_PRESSURE_TOOLS; i++)
+			h->dec.pressure[i] = &soft_pressure;
+	}
+	if (config & FUZZ_AREA) {
+		struct wacom_v_area area = {
+			.x0 = 1000, .y0 = 2000, .x1 = 20000, .y1 = 15000,
+			.rotation = 90, .max_x = 4095,
+		};
+
+		h->area = area;
+		if (wacom_v_area_update(&h->area))
+			fail("bad area", NULL);
+		h->dec.area = &h->area;
+		h->max_x = h->area.max_x;
+		h->max_y = h->area.max_y;
+	}
+}
+
+static void check_range(const struct wacom_v_event *ev, int min, int max)
+{
+	if (ev->value < min || ev->value > max)
+		fail("axis out of range", ev);
+}
+
+static void check_frame(const struct harness *h,
+			const struct wacom_v_frame *frame)
+{
+	const struct wacom_v_event *ev;
+
+	if (frame->nevents < 0 || frame->nevents > WACOM_V_MAX_EVENTS)
+		fail("bad number of events", NULL);
+
+	for (ev = frame->events; ev < frame->events + frame->nevents; ev++) {
+		switch (ev->type) {
+		case EV_ABS:
+			switch (ev->code) {
+			case ABS_X:
+				check_range(ev, 0, h->max_x);
+				break;
+			case ABS_Y:
+				check_range(ev, 0, h->max_y);
+				break;
+			case ABS_PRESSURE:
+				check_range(ev, 0, MAX_Z);
+				break;
+			case ABS_TILT_X:
+			case ABS_TILT_Y:
+				check_range(ev, 0, 2 * TILT_BITS + 1);
+				break;
+			case ABS_THROTTLE:
+				check_range(ev, -1023, 1023);
+				break;
+			case ABS_RZ:
+				check_range(ev, -899, 899);
+				break;
+			case ABS_WHEEL:
+				check_range(ev, 0, 1023);
+				break;
+			case ABS_DISTANCE:
+				/* not registered, only ever reset */
+				check_range(ev, 0, 0);
+				break;
+			default:
+				fail("unexpected axis", ev);
+			}
+			break;
+		case EV_REL:
+			if (ev->code != REL_WHEEL && ev->code != REL_WHEEL_HI_RES)
+				fail("unexpected relative axis", ev);
+			/* one packet never scrolls more than a few clicks */
+			check_range(ev, -64 * WACOM_V_HIRES_PER_CLICK,
+				    64 * WACOM_V_HIRES_PER_CLICK);
+			break;
+		case EV_KEY:
+			if (ev->code < SHADOW_KEY_BASE ||
+			    ev->code >= SHADOW_KEY_BASE + SHADOW_KEY_BITS)
+				fail("unexpected key", ev);
+			check_range(ev, 0, 1);
+			break;
+		case EV_MSC:
+			if (ev->code != MSC_SERIAL)
+				fail("unexpected event", ev);
+			break;
+		default:
+			fail("unexpected event type", ev);
+		}
+	}
+}
+
+static void handle_packet(struct harness *h)
+{
+	struct wacom_v_frame frame;
+	unsigned char *data;
+
+	data = malloc(PACKET_LENGTH);
+	if (!data)
+		abort();
+	memcpy(data, h->fr.data, PACKET_LENGTH);
+
+	h->packets++;
+	if (wacom_v_decode_packet(&h->dec, data, &frame) == WACOM_V_FRAME) {
+		check_frame(h, &frame);
+		h->events += frame.nevents;
+	}
+	free(data);
+}
+
+static void handle_response(struct harness *h)
+{
+	struct wacom_v_response resp;
+	int len = h->fr.idx;
+	char *data;
+
+	if (len < 0 || len >= WACOM_V_MAX_RESPONSE || h->fr.data[len])
+		fail("response not terminated within the buffer", NULL);
+
+	data = malloc(len + 1);
+	if (!data)
+		abort();
+	memcpy(data, h->fr.data, len + 1);
+
+	h->responses++;
+	if (!wacom_v_parse_response(data, len, &resp) && resp.type == 'C') {
+		if (!resp.max_x || resp.max_x > 0xffff ||
+		    !resp.max_y || resp.max_y > 0xffff)
+			fail("bad coordinates accepted", NULL);
+		/* what handle_coordinates_response() does */
+		h->fr.max_x = h->dec.max_x = resp.max_x;
+		h->fr.max_y = h->dec.max_y = resp.max_y;
+		if (!h->dec.area) {
+			h->max_x = resp.max_x;
+			h->max_y = resp.max_y;
+		}
+	}
+	free(data);
+}
+
+static void feed(struct harness *h, unsigned char c, int line_error)
+{
+	switch (wacom_v_framer_feed(&h->fr, c, line_error)) {
+	case WACOM_V_PACKET:
+		handle_packet(h);
+		break;
+	case WACOM_V_RESPONSE:
+		handle_response(h);
+		break;
+	default:
+		break;
+	}
+
+	if (h->fr.idx < 0 || h->fr.idx >= WACOM_V_MAX_RESPONSE)
+		fail("framer index out of bounds", NULL);
+}
+
+static void run(struct harness *h, const unsigned char *data, size_t size,
+		int config)
+{
+	size_t i;
+
+	if (config & FUZZ_FLAGS)
+		for (i = 0; i + 1 < size; i += 2)
+			feed(h, data[i + 1], data[i] & 1);
+	else
+		for (i = 0; i < size; i++)
+			feed(h, data[i], 0);
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	struct harness h;
+
+	if (!size)
+		return 0;
+	harness_init(&h, data[0]);
+	run(&h, data + 1, size - 1, data[0]);
+	return 0;
+}
+
+#ifndef WACOM_V_LIBFUZZER
+
+/* A few seconds of a stylus and a 4D mouse, with setup responses mixed
+ * in, to start mutating from. */
+static size_t make_seed(unsigned char *buf, size_t size, unsigned int seed)
+{
+	static const char *const responses[] = {
+		"~#GD-1212-R V1.1-5\r", "~C20320,15240\r",
+		"~RE202C900,002,02,1270,1270\r",
+	};
+	unsigned char *p = buf, *end = buf + size;
+	int t;
+
+	*p++ = seed & 0x3f;
+	for (t = 0; p + 2 * PACKET_LENGTH + 32 < end; t++) {
+		if (t % 50 == 0) {
+			const char *r = responses[(t / 50) % 3];
+
+			memcpy(p, r, strlen(r));
+			p += strlen(r);
+		}
+		if (t % 200 == 0) {
+			encode_device_id(p, 0, 0x822, 0x1234567);
+			encode_device_id(p + PACKET_LENGTH, 1, 0x094, 0x89abc);
+		} else if (t % 200 == 199) {
+			encode_out_of_proximity(p, 0);
+			encode_out_of_proximity(p + PACKET_LENGTH, 1);
+		} else {
+			encode_stylus(p, 0, (t * 97) % 25000, (t * 31) % 20000,
+				      (t * 7) % (MAX_Z + 1), t & 0x06,
+				      t % 64, (t / 3) % 64);
+			if (t & 1)
+				encode_mouse_4d(p + PACKET_LENGTH, 1,
+						(t * 13) % 25000, t % 20000,
+						(t % 2047) - 1023, t & 0x7f);
+			else
+				encode_mouse_4d_rotation(p + PACKET_LENGTH, 1,
+							 (t * 13) % 25000,
+							 t % 20000, t % 2048);
+		}
+		p += 2 * PACKET_LENGTH;
+	}
+
+	return p - buf;
+}
+
+/* Flip bits, overwrite bytes with interesting values and splice in
+ * garbage, so most of the stream still frames. */
+static void mutate(unsigned char *buf, size_t size, unsigned int *seed)
+{
+	static const unsigned char interesting[] = {
+		0x00, 0x7f, 0x80, 0xff, '~', '\r', '#', 'C', 'R', ',', 'V',
+		'0', '9',
+	};
+	size_t i, n = 1 + rand_r(seed) % 64;
+
+	while (n--) {
+		i = 1 + rand_r(seed) % (size - 1);
+		switch (rand_r(seed) % 3) {
+		case 0:
+			buf[i] ^= 1 << (rand_r(seed) % 8);
+			break;
+		case 1:
+			buf[i] = interesting[rand_r(seed) %
+					     sizeof(interesting)];
+			break;
+		default:
+			buf[i] = rand_r(seed);
+			break;
+		}
+	}
+}
+
+static double cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define STRESS_BLOCK	4096
+
+/* Feeds blocks of well formed, mutated and random streams for the given
+ * number of seconds, timing each block. Returns the number of blocks that
+ * went over the budget. */
+static int stress(int seconds, double budget)
+{
+	static unsigned char seed_stream[1 << 16], buf[STRESS_BLOCK];
+	struct harness h;
+	size_t seed_len, pos = 0;
+	unsigned long long nbytes = 0, nblocks = 0, over = 0;
+	double start, begin, elapsed, worst = 0, total;
+	unsigned int seed = 1;
+	int kind;
+
+	seed_len = make_seed(seed_stream, sizeof(seed_stream), 0);
+	harness_init(&h, FUZZ_FILTER);
+
+	begin = cpu_ns();
+	do {
+		kind = nblocks % 3;
+		if (kind == 2) {
+			size_t i;
+
+			for (i = 0; i < sizeof(buf); i++)
+				buf[i] = rand_r(&seed);
+		} else {
+			if (pos + sizeof(buf) > seed_len)
+				pos = 1;
+			memcpy(buf, seed_stream + pos, sizeof(buf));
+			pos += sizeof(buf);
+			if (kind == 1)
+				mutate(buf, sizeof(buf), &seed);
+		}
+
+		start = cpu_ns();
+		run(&h, buf, sizeof(buf), 0);
+		elapsed = (cpu_ns() - start) / sizeof(buf);
+
+		if (elapsed > worst)
+			worst = elapsed;
+		if (budget > 0 && elapsed > budget)
+			over++;
+		nbytes += sizeof(buf);
+		nblocks++;
+	} while (cpu_ns() - begin < seconds * 1e9);
+	total = cpu_ns() - begin;
+
+	printf("bytes:           %llu\n", nbytes);
+	printf("packets:         %lu\n", h.packets);
+	printf("responses:       %lu\n", h.responses);
+	printf("events:          %lu\n", h.events);
+	printf("cpu ns/byte:     %.2f (worst block %.2f)\n",
+	       total / nbytes, worst);
+	printf("cpu at 38400 Bd: %.4f%%\n", total / nbytes * 3840 / 1e7);
+	if (budget > 0)
+		printf("over budget:     %llu of %llu blocks (%.0f ns/byte)\n",
+		       over, nblocks, budget);
+	return over ? 1 : 0;
+}
+
+/* Without anything to run, a quick check rather than nothing at all */
+#define DEFAULT_ITERATIONS	10000
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-i iterations] [-s seconds [-b budget]] [input...]\n"
+		"  -i iterations  run this many random inputs (%d without\n"
+		"                 any inputs)\n"
+		"  -s seconds     stress test, report CPU time per byte\n"
+		"  -b budget      fail if a block takes more ns per byte\n"
+		"  input          run these inputs, eg. a libFuzzer corpus\n",
+		prog, DEFAULT_ITERATIONS);
+	exit(1);
+}
+
+static int run_file(const char *path)
+{
+	unsigned char *buf;
+	long size;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f || fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0) {
+		perror(path);
+		return 1;
+	}
+	rewind(f);
+	buf = malloc(size ? size : 1);
+	if (!buf || fread(buf, 1, size, f) != size) {
+		perror(path);
+		return 1;
+	}
+	fclose(f);
+
+	LLVMFuzzerTestOneInput(buf, size);
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[1 << 14];
+	unsigned long i, iterations = 0;
+	unsigned int seed = 1;
+	int seconds = 0, opt, err = 0;
+	double budget = 0;
+	size_t len;
+
+	while ((opt = getopt(argc, argv, "i:s:b:h")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			budget = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (seconds)
+		return stress(seconds, budget);
+	if (optind == argc && !iterations)
+		iterations = DEFAULT_ITERATIONS;
+
+	for (; optind < argc; optind++)
+		err |= run_file(argv[optind]);
+
+	for (i = 0; i < iterations; i++) {
+		len = make_seed(buf, 64 + rand_r(&seed) % (sizeof(buf) - 64),
+				seed);
+		mutate(buf, len, &seed);
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+	if (iterations)
+		printf("%lu inputs, no problems found\n", iterations);
+
+	return err;
+}
+
+#endif /* WACOM_V_LIBFUZZER */
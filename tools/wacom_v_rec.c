@@ -0,0 +1,168 @@
+/*
+ * Reader for the packet ring of the Wacom protocol 5 driver.
+ *
+ * Maps the ring of a tablet (/dev/wacom_v_<serio port>, see
+ * wacom_serial5_ring.h) and prints every packet the driver framed, with
+ * its arrival time, channel and flags, until the tablet goes away or
+ * SIGINT. Only waits in poll() when the ring is empty, so a busy tablet
+ * costs no system calls per packet.
+ *
+ * With -w, the raw packets are also written to a file, which
+ * tools/wacom_v_bench and tools/wacom_v_fuzz can replay.
+ *
+ * Build with "make rec" from the top level directory.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "wacom_serial5_core.h"
+#include "wacom_serial5_ring.h"
+
+static volatile sig_atomic_t done;
+
+static void stop(int sig)
+{
+	done = 1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-q] [-w dump] device\n"
+		"  -q       don't print the packets, only the totals\n"
+		"  -w dump  write the raw packets to dump\n"
+		"  device   eg. /dev/wacom_v_serio0\n", prog);
+	exit(1);
+}
+
+static void print_record(const struct wacom_v_ring_record *rec)
+{
+	int i;
+
+	printf("%lld.%09lld %d", rec->time / 1000000000LL,
+	       rec->time % 1000000000LL, rec->channel);
+	for (i = 0; i < PACKET_LENGTH; i++)
+		printf(" %02x", rec->data[i]);
+	if (rec->flags & WACOM_V_RING_LOST)
+		printf(" lost");
+	if (rec->flags & (1 << WACOM_V_DROP_GARBAGE))
+		printf(" garbage");
+	if (rec->flags & (1 << WACOM_V_DROP_TRUNCATED))
+		printf(" truncated");
+	if (rec->flags & (1 << WACOM_V_DROP_LINE_ERROR))
+		printf(" line_error");
+	if (rec->flags & (1 << WACOM_V_DROP_OUT_OF_RANGE))
+		printf(" out_of_range");
+	if (rec->flags & (1 << WACOM_V_DROP_BAD_RESPONSE))
+		printf(" bad_response");
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct wacom_v_ring_header *hdr;
+	const struct wacom_v_ring_record *rec;
+	unsigned long long nrecords = 0;
+	const char *dump = NULL;
+	FILE *out = NULL;
+	size_t size;
+	__u32 head, tail;
+	int fd, quiet = 0, opt;
+
+	while ((opt = getopt(argc, argv, "qw:h")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = 1;
+			break;
+		case 'w':
+			dump = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	hdr = mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	if (hdr->version != WACOM_V_RING_VERSION ||
+	    hdr->record_size != sizeof(*rec)) {
+		fprintf(stderr, "Ring version %u, record size %u: "
+			"not what this was built for\n",
+			hdr->version, hdr->record_size);
+		return 1;
+	}
+	size = hdr->data_offset + (size_t)hdr->nrecords * hdr->record_size;
+	munmap(hdr, getpagesize());
+
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	rec = (const void *)((const char *)hdr + hdr->data_offset);
+
+	if (dump) {
+		out = fopen(dump, "wb");
+		if (!out) {
+			perror(dump);
+			return 1;
+		}
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	tail = hdr->tail;
+	while (!done) {
+		head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+				perror("poll");
+				break;
+			}
+			if (pfd.revents & POLLHUP)
+				break;
+			continue;
+		}
+
+		for (; tail != head; tail++) {
+			const struct wacom_v_ring_record *r =
+				&rec[tail & (hdr->nrecords - 1)];
+
+			if (!quiet)
+				print_record(r);
+			if (out)
+				fwrite(r->data, 1, PACKET_LENGTH, out);
+			nrecords++;
+		}
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	fprintf(stderr, "%llu packets, %u lost\n", nrecords, hdr->lost);
+	if (out)
+		fclose(out);
+	munmap(hdr, size);
+	close(fd);
+	return 0;
+}
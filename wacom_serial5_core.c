@@ -0,0 +1,1129 @@
+/*
+ * Wacom protocol 5 packet decoder
+ *
+ * Split out of the serial tablet driver, see wacom_serial5_core.h and
+ * wacom_serial5_drv.c.
+ */
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/rcupdate.h>
+#else
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define rcu_read_lock()		do { } while (0)
+#define rcu_read_unlock()	do { } while (0)
+#define rcu_dereference(p)	(p)
+#define READ_ONCE(x)		(*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+#endif
+
+#include "wacom_serial5_core.h"
+
+#ifdef __KERNEL__
+#include "wacom_serial5_trace.h"
+#else
+#define trace_wacom_v_device_id(state)		do { } while (0)
+#define trace_wacom_v_out_of_proximity(state)	do { } while (0)
+#endif
+
+/* Everything we need to know about a tool to decode its packets. Resolved
+ * once from the tool ID in the device ID packet. */
+struct wacom_v_tool_ops {
+	int tool;		/* BTN_TOOL_XXX */
+	/* decodes the tool specific part of a first cursor packet */
+	void (*cursor_packet)(struct wacom_v_decoder *dec,
+			      struct wacom_v_frame *frame,
+			      const unsigned char *data,
+			      struct tool_state *state);
+	const __u16 *buttons;	/* event code per button bit */
+	const struct wacom_v_event *reset; /* sent when leaving proximity */
+	int nreset;
+	int pressure;		/* WACOM_V_PRESSURE_XXX, for styli */
+};
+
+static void report_event(struct wacom_v_frame *frame,
+			 int type, int code, int value)
+{
+	struct wacom_v_event *ev;
+
+	if (frame->nevents >= WACOM_V_MAX_EVENTS)
+		return;
+
+	ev = &frame->events[frame->nevents++];
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+static void report_abs(struct wacom_v_frame *frame, int code, int value)
+{
+	report_event(frame, EV_ABS, code, value);
+}
+
+static void report_rel(struct wacom_v_frame *frame, int code, int value)
+{
+	report_event(frame, EV_REL, code, value);
+}
+
+/* Clips a position to the active area, rotates it and scales it to the
+ * reported range, all in integers with the multipliers precomputed by
+ * wacom_v_area_update(). */
+static void map_position(const struct wacom_v_area *area, int *x, int *y)
+{
+	int w = area->x1 - area->x0, h = area->y1 - area->y0;
+	int u, v, t;
+
+	u = *x < area->x0 ? 0 : *x > area->x1 ? w : *x - area->x0;
+	v = *y < area->y0 ? 0 : *y > area->y1 ? h : *y - area->y0;
+
+	switch (area->rotation) {
+	case 90:
+		t = u;
+		u = h - v;
+		v = t;
+		break;
+	case 180:
+		u = w - u;
+		v = h - v;
+		break;
+	case 270:
+		t = u;
+		u = v;
+		v = w - t;
+		break;
+	}
+
+	*x = ((__u64)u * area->scale_x) >> WACOM_V_FIXED_SHIFT;
+	*y = ((__u64)v * area->scale_y) >> WACOM_V_FIXED_SHIFT;
+}
+
+static void send_position(struct wacom_v_decoder *dec,
+			  struct wacom_v_frame *frame,
+			  const unsigned char *data) {
+	int x, y;
+	x = ((data[1] & 0x7f) << 9) |
+	    ((data[2] & 0x7f) << 2) |
+	    ((data[3] & 0x60) >> 5);
+	y = ((data[3] & 0x1f) << 11) |
+	    ((data[4] & 0x7f) <<  4) |
+	    ((data[5] & 0x78) >>  3);
+	if (dec->cur_area)
+		map_position(dec->cur_area, &x, &y);
+	report_abs(frame, ABS_X, x);
+	report_abs(frame, ABS_Y, y);
+}
+
+static void report_key(struct wacom_v_frame *frame,
+		       int buttons, int bit, int code) {
+	report_event(frame, EV_KEY, code, (buttons & (1 << bit)) >> bit);
+}
+
+static void send_buttons(struct wacom_v_frame *frame,
+			 int buttons, const __u16 *map) {
+	int bit;
+
+	/* Reversed mappings of buttonmask to button codes.
+	 * Found in wcmUSB.c of xf86-input-wacom,
+	 * tree: f0c8aa9962e0238557d103baa4a5ba57484fd1c9
+	 *
+	 * commit
+	 * b3cba4e3543a98103282ba8fa55bf38012d23d9f
+	 *
+	 * bit	event code
+	 * 0	BTN_LEFT
+	 * 1	BTN_STYLUS or BTN_MIDDLE
+	 * 2	BTN_STYLUS2 or BTN_RIGHT
+	 * 3	BTN_SIDE
+	 * 4	BTN_EXTRA
+	 * not too sure of these:
+	 * 5	BTN_FORWARD
+	 * 6	BTN_BACK
+	 * 7	BTN_TASK
+	 *
+	 * Note that we are doing "double" work here, as the wacom driver
+	 * will make the reverse transformation.
+	 * We could probably in-line this so we only look at the relevant
+	 * bits that aren't masked anyway, but that leads to a bit of code
+	 * duplication. Let's hope the compiler is smart enough to do that
+	 * automagically.
+	 *
+	 * The map is one of the *_buttons tables below, as picked by the
+	 * tool ops of the tool in question. A zero entry means the bit is
+	 * not reported.
+	 */
+	for (bit = 0; bit < 8; bit++)
+		if (map[bit])
+			report_key(frame, buttons, bit, map[bit]);
+}
+
+static const __u16 stylus_buttons[8] = {
+	0, /* TODO: report BTN_TOUCH instead? -- however, bit 0 seems
+	    * to be 0 all the time */
+	BTN_STYLUS, BTN_STYLUS2, BTN_SIDE, BTN_EXTRA,
+	BTN_FORWARD, BTN_BACK, BTN_TASK
+};
+
+static const __u16 cursor_buttons[8] = {
+	BTN_LEFT, BTN_MIDDLE, BTN_RIGHT, BTN_SIDE, BTN_EXTRA,
+	BTN_FORWARD, BTN_BACK, BTN_TASK
+};
+
+#if 0
+static int device_type_from_tool(int tool)
+{
+	switch (tool) {
+	case BTN_TOOL_RUBBER:
+		return ERASER_DEVICE_ID;
+
+	case BTN_TOOL_PENCIL:
+	case BTN_TOOL_PEN:
+	case BTN_TOOL_BRUSH:
+	case BTN_TOOL_AIRBRUSH:
+		return STYLUS_DEVICE_ID;
+
+	case BTN_TOOL_MOUSE:
+	case BTN_TOOL_LENS:
+		return CURSOR_DEVICE_ID;
+
+	default: /* Unknown tool */
+		return STYLUS_DEVICE_ID;
+	}
+}
+#endif
+
+static void out_of_proximity_reset(struct wacom_v_frame *frame,
+				   struct tool_state *state)
+{
+	const struct wacom_v_tool_ops *ops = state->ops;
+	const struct wacom_v_event *ev;
+
+	/* Don't reset state if we already did so (= we already are out of
+	 * prox). Otherwise we have problems with kernel event filtering
+	 * (BTN_TOOL events remain 0 and get filtered out) when we have two
+	 * tools on the tablet (the reset events will be assigned to the
+	 * other tool if that one is still in prox). */
+	if (!state->proximity)
+		return;
+
+	state->proximity = 0;
+	state->tracker.valid = 0;
+	trace_wacom_v_out_of_proximity(state);
+
+	/* Reset everything, otherwise we lose the initial states
+	 * when in-prox next time */
+	for (ev = ops->reset; ev < ops->reset + ops->nreset; ev++)
+		report_event(frame, ev->type, ev->code, ev->value);
+}
+
+static int handle_proximity_bit(struct wacom_v_frame *frame,
+				const unsigned char *data,
+				struct tool_state *state)
+{
+	int proximity;
+
+	proximity = (data[0] & PROXIMITY_BIT);
+	if (!proximity) {
+		out_of_proximity_reset(frame, state);
+	} else {
+		state->proximity = 1;
+	}
+
+	return proximity;
+}
+
+
+/* The pressure curve of the tool, if one was loaded. The driver swaps
+ * tables with RCU, so a packet sees either the old or the new one. */
+static int map_pressure(const struct wacom_v_decoder *dec,
+			const struct tool_state *state, int z)
+{
+	const struct wacom_v_pressure_lut *lut;
+
+	rcu_read_lock();
+	lut = rcu_dereference(dec->pressure[state->ops->pressure]);
+	if (lut)
+		z = lut->z[z];
+	rcu_read_unlock();
+	return z;
+}
+
+static void handle_general_stylus_packet(struct wacom_v_decoder *dec,
+					 struct wacom_v_frame *frame,
+					 const unsigned char *data,
+					 struct tool_state *state)
+{
+	int z, buttons, abswheel, tiltx, tilty;
+
+	if (!handle_proximity_bit(frame, data, state))
+		return;
+
+	send_position(dec, frame, data);
+
+	if ((data[0] & 0xb8) == 0xa0) {
+		z = (((data[5] & 0x07) << 7) | (data[6] & 0x7f));
+		report_abs(frame, ABS_PRESSURE, map_pressure(dec, state, z));
+
+		buttons = (data[0] & 0x06);
+		send_buttons(frame, buttons, state->ops->buttons);
+	}
+	else {
+		abswheel = (((data[5] & 0x07) << 7) |
+			(data[6] & 0x7f));
+		report_abs(frame, ABS_WHEEL, abswheel);
+	}
+
+	tiltx = (data[7] & TILT_BITS);
+	tilty = (data[8] & TILT_BITS);
+	if (data[7] & TILT_SIGN_BIT)
+		tiltx -= (TILT_BITS + 1);
+	if (data[8] & TILT_SIGN_BIT)
+		tilty -= (TILT_BITS + 1);
+
+	/* TODO: xf86-wacom-input assumes a mintilt of 0 and only positive
+	 * tilt values -- fix there or here? (here for now) */
+	report_abs(frame, ABS_TILT_X, tiltx + TILT_BITS + 1);
+	report_abs(frame, ABS_TILT_Y, tilty + TILT_BITS + 1);
+}
+
+/* Every packet, the thumbwheel scrolls by throttle / pos_delay (or
+ * neg_delay) clicks, times the acceleration. This is integrated in 16.16
+ * fixed point hi-res units (1/120 of a click) so no resolution is lost,
+ * using the scales precomputed by wacom_v_params_update(). Pushing the
+ * wheel forward scrolls down, as it always did. */
+static void send_scroll(struct wacom_v_frame *frame, int throttle,
+			const struct wacom_v_params *params,
+			struct tool_state *state)
+{
+	int magnitude = throttle < 0 ? -throttle : throttle;
+	__s64 v;
+	int hires, clicks;
+
+	if (throttle == 0) {
+		/* wheel released, stop right away */
+		state->scroll = 0;
+		state->wheel = 0;
+		return;
+	}
+
+	/* The derived params change under us, see wacom_v_params_update() */
+	if (throttle > 0)
+		v = -(__s64)magnitude * READ_ONCE(params->pos_scale);
+	else
+		v = (__s64)magnitude * READ_ONCE(params->neg_scale);
+	v = (v * (WACOM_V_FIXED_ONE +
+		  (magnitude * READ_ONCE(params->accel_scale) >> 8)))
+		>> WACOM_V_FIXED_SHIFT;
+
+	state->scroll += v;
+	hires = state->scroll >> WACOM_V_FIXED_SHIFT;
+	if (!hires)
+		return;
+	state->scroll -= (__s64)hires * WACOM_V_FIXED_ONE;
+
+	/* REL_WHEEL follows the hi-res value, a click per 120 units in
+	 * the same direction */
+	if ((hires < 0) != (state->wheel < 0))
+		state->wheel = 0;
+	state->wheel += hires;
+	clicks = state->wheel / WACOM_V_HIRES_PER_CLICK;
+	state->wheel -= clicks * WACOM_V_HIRES_PER_CLICK;
+
+	report_rel(frame, REL_WHEEL_HI_RES, hires);
+	report_rel(frame, REL_WHEEL, clicks);
+}
+
+static void mouse_4d_cursor_packet(struct wacom_v_decoder *dec,
+				   struct wacom_v_frame *frame,
+				   const unsigned char *data,
+				   struct tool_state *state)
+{
+	struct wacom_v_params *params = dec->params;
+	int throttle, buttons;
+
+	buttons = ((data[8] & 0x70) >> 1) |
+		   (data[8] & 0x07);
+	send_buttons(frame, buttons, state->ops->buttons);
+	throttle = (((data[5] & 0x07) << 7) |
+		(data[6] & 0x7f));
+	if (data[8] & 0x08)
+		throttle = -throttle;
+	params->thumbwheel = throttle; // Report decoded value to userspace
+	throttle -= params->thumbwheel_offset;
+	if (params->th_mode) { // Abs Throttle mode
+		if (throttle > 1023)
+			throttle = 1023;
+		else if (throttle < -1023)
+			throttle = -1023;
+		report_abs(frame, ABS_THROTTLE, throttle);
+	} else { // Scroll wheel mode
+		if ((throttle < params->deadband) &&
+		    (throttle > -params->deadband))
+			throttle = 0;
+		send_scroll(frame, throttle, params, state);
+	}
+}
+
+static void lens_cursor_packet(struct wacom_v_decoder *dec,
+			       struct wacom_v_frame *frame,
+			       const unsigned char *data,
+			       struct tool_state *state)
+{
+	int buttons;
+
+	buttons = data[8];
+	send_buttons(frame, buttons, state->ops->buttons);
+}
+
+static void mouse_2d_cursor_packet(struct wacom_v_decoder *dec,
+				   struct wacom_v_frame *frame,
+				   const unsigned char *data,
+				   struct tool_state *state)
+{
+	int buttons, relwheel;
+
+	buttons = (data[8] & 0x1C) >> 2;
+	send_buttons(frame, buttons, state->ops->buttons);
+
+	relwheel = (data[8] & 1) - ((data[8] & 2) >> 1);
+	report_rel(frame, REL_WHEEL_HI_RES, relwheel * WACOM_V_HIRES_PER_CLICK);
+	report_rel(frame, REL_WHEEL, relwheel);
+}
+
+/* For tools that don't have anything beyond the position in a first
+ * cursor packet. */
+static void no_cursor_packet(struct wacom_v_decoder *dec,
+			     struct wacom_v_frame *frame,
+			     const unsigned char *data,
+			     struct tool_state *state)
+{
+}
+
+#define RESET_ABS(code)	{ EV_ABS, code, 0 }
+#define RESET_KEY(code)	{ EV_KEY, code, 0 }
+
+static const struct wacom_v_event stylus_reset[] = {
+	RESET_ABS(ABS_X),
+	RESET_ABS(ABS_Y),
+	RESET_ABS(ABS_DISTANCE),
+	RESET_ABS(ABS_TILT_X),
+	RESET_ABS(ABS_TILT_Y),
+	RESET_ABS(ABS_PRESSURE),
+	RESET_KEY(BTN_STYLUS),
+	RESET_KEY(BTN_STYLUS2),
+	//RESET_KEY(BTN_TOUCH),
+	RESET_ABS(ABS_WHEEL),
+};
+
+static const struct wacom_v_event cursor_reset[] = {
+	RESET_ABS(ABS_X),
+	RESET_ABS(ABS_Y),
+	RESET_ABS(ABS_DISTANCE),
+	RESET_ABS(ABS_TILT_X),
+	RESET_ABS(ABS_TILT_Y),
+	RESET_KEY(BTN_LEFT),
+	RESET_KEY(BTN_MIDDLE),
+	RESET_KEY(BTN_RIGHT),
+	RESET_KEY(BTN_SIDE),
+	RESET_KEY(BTN_EXTRA),
+	RESET_ABS(ABS_THROTTLE),
+	RESET_ABS(ABS_RZ),
+};
+
+#define STYLUS_OPS(btn_tool, curve) {			\
+	.tool		= btn_tool,			\
+	.pressure	= curve,			\
+	.cursor_packet	= no_cursor_packet,		\
+	.buttons	= stylus_buttons,		\
+	.reset		= stylus_reset,			\
+	.nreset		= ARRAY_SIZE(stylus_reset),	\
+}
+
+#define CURSOR_OPS(btn_tool, decode) {			\
+	.tool		= btn_tool,			\
+	.cursor_packet	= decode,			\
+	.buttons	= cursor_buttons,		\
+	.reset		= cursor_reset,			\
+	.nreset		= ARRAY_SIZE(cursor_reset),	\
+}
+
+static const struct wacom_v_tool_ops pencil_ops =
+	STYLUS_OPS(BTN_TOOL_PENCIL, WACOM_V_PRESSURE_PENCIL);
+static const struct wacom_v_tool_ops pen_ops =
+	STYLUS_OPS(BTN_TOOL_PEN, WACOM_V_PRESSURE_PEN);
+static const struct wacom_v_tool_ops brush_ops =
+	STYLUS_OPS(BTN_TOOL_BRUSH, WACOM_V_PRESSURE_BRUSH);
+static const struct wacom_v_tool_ops rubber_ops =
+	STYLUS_OPS(BTN_TOOL_RUBBER, WACOM_V_PRESSURE_RUBBER);
+static const struct wacom_v_tool_ops airbrush_ops =
+	STYLUS_OPS(BTN_TOOL_AIRBRUSH, WACOM_V_PRESSURE_AIRBRUSH);
+static const struct wacom_v_tool_ops mouse_2d_ops =
+	CURSOR_OPS(BTN_TOOL_MOUSE, mouse_2d_cursor_packet);
+static const struct wacom_v_tool_ops mouse_4d_ops =
+	CURSOR_OPS(BTN_TOOL_MOUSE, mouse_4d_cursor_packet);
+static const struct wacom_v_tool_ops mouse_ops =
+	CURSOR_OPS(BTN_TOOL_MOUSE, no_cursor_packet);
+static const struct wacom_v_tool_ops lens_ops =
+	CURSOR_OPS(BTN_TOOL_LENS, lens_cursor_packet);
+
+/* The original old serial code masked the MSB from tool_id
+ * (mask: 0x7ff). New code does not seem to do this. We don't
+ * either, except for the cursors, see tool_ops_from_tool_id().
+ * IDs ripped from wacom_wac.c from the kernel and pruned for
+ * Intuos and Intuos2 compatible tools only.  */
+static const struct {
+	__u16 tool_id;
+	const struct wacom_v_tool_ops *ops;
+} tool_ids[] = {
+	{ 0x812, &pencil_ops },		/* Inking pen */
+	{ 0x012, &pencil_ops },
+	{ 0x822, &pen_ops },		/* Pen */
+	{ 0x842, &pen_ops },
+	{ 0x852, &pen_ops },
+	{ 0x022, &pen_ops },
+	{ 0x832, &brush_ops },		/* Stroke pen */
+	{ 0x032, &brush_ops },
+	{ 0x007, &mouse_2d_ops },	/* Mouse 2D */
+	{ 0x094, &mouse_4d_ops },	/* Mouse 4D */
+	{ 0x09c, &mouse_ops },		/* Not in old code -- not compatbile? */
+	{ 0x096, &lens_ops },		/* Lens cursor */
+	{ 0x82a, &rubber_ops },		/* Eraser */
+	{ 0x85a, &rubber_ops },
+	{ 0x91a, &rubber_ops },
+	{ 0xd1a, &rubber_ops },
+	{ 0x0fa, &rubber_ops },
+	{ 0xd12, &airbrush_ops },	/* Airbrush */
+	{ 0x912, &airbrush_ops },
+	{ 0x112, &airbrush_ops },
+};
+
+static const struct wacom_v_tool_ops *tool_ops_from_tool_id(int tool_id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tool_ids); i++)
+		if (tool_ids[i].tool_id == tool_id)
+			return tool_ids[i].ops;
+
+	/* The cursor packets were always decoded by the masked ID (eg.
+	 * 0x894 as a 4D mouse), keep doing that. */
+	for (i = 0; i < ARRAY_SIZE(tool_ids); i++)
+		if (tool_ids[i].ops->buttons == cursor_buttons &&
+		    tool_ids[i].tool_id == (tool_id & 0x7ff))
+			return tool_ids[i].ops;
+
+	return &pen_ops; /* Unknown tool */
+}
+
+static void handle_device_id_packet(struct wacom_v_decoder *dec,
+				    struct wacom_v_frame *frame,
+				    const unsigned char *data,
+				    struct tool_state *state)
+{
+	int tool_id;
+	state->proximity = 0; /* Don't enable it here, yet. Let a packet
+				 with an actual valid position etc do it. */
+
+	state->serial_num = ((__u32)(data[2] & 0x03) << 30) |
+			((data[3] & 0x7f) << 23) |
+			((data[4] & 0x7f) << 16) |
+			((data[5] & 0x7f) <<  9) |
+			((data[6] & 0x7f) <<  2) |
+			((data[7] & 0x60) >>  5);
+
+	tool_id = ((data[1] & 0x7f) << 5) |
+			((data[2] & 0x7c) >> 2);
+	state->tool_id = tool_id;
+
+	state->ops = tool_ops_from_tool_id(tool_id);
+	state->tool = state->ops->tool;
+	state->tracker.valid = 0;
+	trace_wacom_v_device_id(state);
+
+	//state->device_type = device_type_from_tool(state->tool);
+}
+
+static void handle_first_cursor_packet(struct wacom_v_decoder *dec,
+				       struct wacom_v_frame *frame,
+				       const unsigned char *data,
+				       struct tool_state *state)
+{
+	if (!handle_proximity_bit(frame, data, state))
+		return;
+
+	send_position(dec, frame, data);
+
+	state->ops->cursor_packet(dec, frame, data, state);
+}
+
+static void handle_second_cursor_packet(struct wacom_v_decoder *dec,
+					struct wacom_v_frame *frame,
+					const unsigned char *data,
+					struct tool_state *state)
+{
+	int rotation;
+
+	if (!handle_proximity_bit(frame, data, state))
+		return;
+
+	send_position(dec, frame, data);
+
+	rotation = (((data[6] & 0x0f) << 7) |
+		(data[7] & 0x7f));
+	if (rotation < 900)
+		rotation = -rotation;
+	else
+		rotation = 1799 - rotation;
+	report_abs(frame, ABS_RZ, rotation);
+}
+
+static void handle_out_of_proximity_packet(struct wacom_v_decoder *dec,
+					   struct wacom_v_frame *frame,
+					   const unsigned char *data,
+					   struct tool_state *state)
+{
+	out_of_proximity_reset(frame, state);
+	state->device_id = 0; // XXX?
+}
+
+typedef void (*packet_handler_t)(struct wacom_v_decoder *dec,
+				 struct wacom_v_frame *frame,
+				 const unsigned char *data,
+				 struct tool_state *state);
+
+static const packet_handler_t packet_handlers[PACKET_NUM_TYPES] = {
+	[PACKET_DEVICE_ID]		= handle_device_id_packet,
+	[PACKET_OUT_OF_PROXIMITY]	= handle_out_of_proximity_packet,
+	[PACKET_GENERAL_STYLUS]		= handle_general_stylus_packet,
+	[PACKET_FIRST_CURSOR]		= handle_first_cursor_packet,
+	[PACKET_SECOND_CURSOR]		= handle_second_cursor_packet,
+};
+
+/* Classification of a packet by its header byte. The tests are done in
+ * this order, the first match wins. */
+#define PACKET_TYPE(h) ( \
+	/* Device ID packet */ \
+	((h) & 0xfc) == 0xc0 ? PACKET_DEVICE_ID : \
+	/* Out of proximity packet */ \
+	((h) & 0xfe) == 0x80 ? PACKET_OUT_OF_PROXIMITY : \
+	/* General pen packet or eraser packet or airbrush first packet \
+	 * airbrush second packet */ \
+	((h) & 0xb8) == 0xa0 ? PACKET_GENERAL_STYLUS : \
+	((h) & 0xbe) == 0xb4 ? PACKET_GENERAL_STYLUS : \
+	/* 4D mouse 1st packet or Lens cursor packet or 2D mouse packet*/ \
+	((h) & 0xbe) == 0xa8 ? PACKET_FIRST_CURSOR : \
+	((h) & 0xbe) == 0xb0 ? PACKET_FIRST_CURSOR : \
+	/* 4D mouse 2nd packet */ \
+	((h) & 0xbe) == 0xaa ? PACKET_SECOND_CURSOR : \
+	PACKET_UNKNOWN)
+
+struct packet_class {
+	unsigned char type;	/* enum packet_type */
+	unsigned char channel;
+};
+
+#define CLASS1(h)  { PACKET_TYPE(h), (h) & 1 }
+#define CLASS4(h)  CLASS1(h), CLASS1(h + 1), CLASS1(h + 2), CLASS1(h + 3)
+#define CLASS16(h) CLASS4(h), CLASS4(h + 4), CLASS4(h + 8), CLASS4(h + 12)
+#define CLASS64(h) CLASS16(h), CLASS16(h + 16), CLASS16(h + 32), \
+		   CLASS16(h + 48)
+
+/* Indexed by the header byte (data[0]) of a packet. */
+static const struct packet_class packet_classes[256] = {
+	CLASS64(0x00), CLASS64(0x40), CLASS64(0x80), CLASS64(0xc0)
+};
+
+/* Returns whether the event changes anything compared to what we reported
+ * before, and updates the shadow if so. */
+static int shadow_update(struct wacom_v_shadow *shadow,
+			 const struct wacom_v_event *ev, int tool)
+{
+	unsigned int bit, word;
+	__u32 mask;
+
+	switch (ev->type) {
+	case EV_ABS:
+		if (ev->code >= ABS_CNT)
+			return 1;
+		if ((shadow->abs_valid & (1ULL << ev->code)) &&
+		    shadow->abs[ev->code] == ev->value)
+			return 0;
+		shadow->abs_valid |= 1ULL << ev->code;
+		shadow->abs[ev->code] = ev->value;
+		return 1;
+
+	case EV_KEY:
+		bit = ev->code - SHADOW_KEY_BASE;
+		if (ev->code < SHADOW_KEY_BASE || bit >= SHADOW_KEY_BITS)
+			return 1;
+		word = bit / 32;
+		mask = 1U << (bit % 32);
+		if ((shadow->keys_valid[word] & mask) &&
+		    !(shadow->keys[word] & mask) == !ev->value)
+			return 0;
+		shadow->keys_valid[word] |= mask;
+		if (ev->value)
+			shadow->keys[word] |= mask;
+		else
+			shadow->keys[word] &= ~mask;
+		return 1;
+
+	case EV_REL:
+		/* The input core drops these anyway */
+		return ev->value != 0;
+
+	case EV_MSC:
+		/* Only tell which tool this is when that changes */
+		if (ev->code != MSC_SERIAL)
+			return 1;
+		if (shadow->serial_valid && shadow->tool == tool &&
+		    shadow->serial_num == (__u32)ev->value)
+			return 0;
+		shadow->serial_valid = 1;
+		shadow->serial_num = ev->value;
+		shadow->tool = tool;
+		return 1;
+
+	default:
+		return 1;
+	}
+}
+
+/* Drop everything from the frame that was already reported for this
+ * channel. If both channels share the same input device, the shadow of a
+ * channel is only trusted if that channel was also the last one to report
+ * anything. */
+static void filter_frame(struct wacom_v_decoder *dec, int channel,
+			 struct wacom_v_frame *frame)
+{
+	struct tool_state *state = &dec->tool_state[channel];
+	struct wacom_v_shadow *shadow = &state->shadow;
+	int i, n = 0;
+
+	if (!dec->separate_devices && dec->shadow_channel != channel) {
+		shadow->abs_valid = 0;
+		memset(shadow->keys_valid, 0, sizeof(shadow->keys_valid));
+		shadow->serial_valid = 0;
+	}
+
+	for (i = 0; i < frame->nevents; i++)
+		if (shadow_update(shadow, &frame->events[i], state->tool))
+			frame->events[n++] = frame->events[i];
+	frame->nevents = n;
+
+	if (n)
+		dec->shadow_channel = channel;
+}
+
+const char *const wacom_v_packet_type_names[PACKET_NUM_TYPES] = {
+	[PACKET_UNKNOWN]		= "unknown",
+	[PACKET_DEVICE_ID]		= "device_id",
+	[PACKET_OUT_OF_PROXIMITY]	= "out_of_proximity",
+	[PACKET_GENERAL_STYLUS]		= "stylus",
+	[PACKET_FIRST_CURSOR]		= "first_cursor",
+	[PACKET_SECOND_CURSOR]		= "second_cursor",
+};
+
+/* An alpha-beta tracker per channel, in units of packets of that channel:
+ * the measurement is blended into the predicted position with gain
+ * alpha/256 and the residual corrects the velocity with gain beta/256.
+ * What gets reported is the filtered position extrapolated by the
+ * prediction horizon, to make up for the time the packet spent on the
+ * serial line, clamped to 0 to max. Zero pressure is passed through as is
+ * so the pen never lifts late or touches early. */
+static int track_axis(struct wacom_v_tracker *tr, int axis, int value,
+		      int max, const struct wacom_v_params *params)
+{
+	int m = value << 8, pred, r, out;
+
+	if (!tr->valid) {
+		tr->pos[axis] = m;
+		tr->vel[axis] = 0;
+		return value;
+	}
+
+	pred = tr->pos[axis] + tr->vel[axis];
+	r = m - pred;
+	tr->pos[axis] = pred + ((params->filter_alpha * (__s64)r) >> 8);
+	tr->vel[axis] += (params->filter_beta * (__s64)r) >> 8;
+
+	out = (tr->pos[axis] +
+	       ((READ_ONCE(params->horizon) * (__s64)tr->vel[axis]) >> 8)) >> 8;
+	if (out < 0)
+		return 0;
+	return out > max ? max : out;
+}
+
+/* The X and Y fields of a packet are 16 bits wide */
+#define POSITION_MAX	0xffff
+
+static void track_frame(struct wacom_v_frame *frame,
+			const struct wacom_v_decoder *dec,
+			struct tool_state *state)
+{
+	const struct wacom_v_params *params = dec->params;
+	struct wacom_v_tracker *tr = &state->tracker;
+	struct wacom_v_event *ev;
+	int max_x = dec->max_x ?: POSITION_MAX;
+	int max_y = dec->max_y ?: POSITION_MAX;
+	int seen = 0;
+
+	if (dec->cur_area) {
+		max_x = dec->cur_area->max_x;
+		max_y = dec->cur_area->max_y;
+	}
+
+	if (!state->proximity) {
+		tr->valid = 0;
+		return;
+	}
+
+	for (ev = frame->events; ev < frame->events + frame->nevents; ev++) {
+		if (ev->type != EV_ABS)
+			continue;
+
+		switch (ev->code) {
+		case ABS_X:
+			ev->value = track_axis(tr, TRACK_X, ev->value,
+					       max_x, params);
+			seen = 1;
+			break;
+		case ABS_Y:
+			ev->value = track_axis(tr, TRACK_Y, ev->value,
+					       max_y, params);
+			seen = 1;
+			break;
+		case ABS_PRESSURE:
+			if (ev->value == 0) {
+				tr->pos[TRACK_PRESSURE] = 0;
+				tr->vel[TRACK_PRESSURE] = 0;
+				break;
+			}
+			ev->value = track_axis(tr, TRACK_PRESSURE, ev->value,
+					       MAX_Z, params);
+			if (ev->value == 0)
+				ev->value = 1;
+			break;
+		}
+	}
+
+	if (seen)
+		tr->valid = 1;
+}
+
+void wacom_v_params_update(struct wacom_v_params *params)
+{
+	int pos = params->pos_delay > 0 ? params->pos_delay : 1;
+	int neg = params->neg_delay < 0 ? -params->neg_delay : 1;
+
+	/* The decoder may be reading them at the same time */
+	WRITE_ONCE(params->pos_scale,
+		   (WACOM_V_HIRES_PER_CLICK << WACOM_V_FIXED_SHIFT) / pos);
+	WRITE_ONCE(params->neg_scale,
+		   (WACOM_V_HIRES_PER_CLICK << WACOM_V_FIXED_SHIFT) / neg);
+	/* scroll_accel percent more at full throttle (1023) */
+	WRITE_ONCE(params->accel_scale,
+		   ((params->scroll_accel << WACOM_V_FIXED_SHIFT) /
+		    1023 << 8) / 100);
+	WRITE_ONCE(params->horizon, (params->predict << 8) / 100);
+}
+
+void wacom_v_decoder_init(struct wacom_v_decoder *dec,
+			  struct wacom_v_params *params)
+{
+	int i;
+
+	memset(dec, 0, sizeof(*dec));
+	for (i = 0; i < ARRAY_SIZE(dec->tool_state); i++)
+		dec->tool_state[i].channel = i;
+	dec->params = params;
+	wacom_v_params_update(params);
+	dec->shadow_channel = -1;
+}
+
+/* The events every packet of a known tool ends with */
+static enum wacom_v_result finish_frame(struct wacom_v_decoder *dec,
+					int channel,
+					struct wacom_v_frame *frame)
+{
+	struct tool_state *state = &dec->tool_state[channel];
+
+	//report_abs(frame, ABS_MISC, state->tool_id);
+	report_event(frame, EV_KEY, state->tool, state->proximity);
+	report_event(frame, EV_MSC, MSC_SERIAL, state->serial_num);
+
+	filter_frame(dec, channel, frame);
+	if (!frame->nevents)
+		return WACOM_V_IGNORED;
+	return WACOM_V_FRAME;
+}
+
+enum wacom_v_result wacom_v_decode_packet(struct wacom_v_decoder *dec,
+					  const unsigned char *data,
+					  struct wacom_v_frame *frame)
+{
+	const struct packet_class *class = &packet_classes[data[0]];
+	struct tool_state *state = &dec->tool_state[class->channel];
+
+	frame->nevents = 0;
+
+	dec->packets[class->type]++;
+	if (class->type == PACKET_UNKNOWN)
+		return WACOM_V_UNKNOWN;
+
+	if (class->type != PACKET_DEVICE_ID && state->tool_id == 0)
+		return WACOM_V_IGNORED; /* Eek! We don't know the current tool yet! */
+
+	/* One area for the whole packet, even if it is being replaced */
+	rcu_read_lock();
+	dec->cur_area = rcu_dereference(dec->area);
+	packet_handlers[class->type](dec, frame, data, state);
+	if (dec->params->filter)
+		track_frame(frame, dec, state);
+	dec->cur_area = NULL;
+	rcu_read_unlock();
+
+	return finish_frame(dec, class->channel, frame);
+}
+
+/* Takes the tool on a channel out of proximity as if the tablet had said
+ * so, and forgets about it until the next device ID packet. For when the
+ * line went away, see the driver's reconnect. */
+enum wacom_v_result wacom_v_decoder_release(struct wacom_v_decoder *dec,
+					    int channel,
+					    struct wacom_v_frame *frame)
+{
+	struct tool_state *state = &dec->tool_state[channel];
+
+	frame->nevents = 0;
+	if (state->tool_id == 0)
+		return WACOM_V_IGNORED;
+
+	out_of_proximity_reset(frame, state);
+	state->device_id = 0;
+	state->tool_id = 0;
+	state->scroll = 0;
+	state->wheel = 0;
+
+	return finish_frame(dec, channel, frame);
+}
+
+enum framer_state {
+	FRAMER_IDLE,		/* waiting for a header byte or a '~' */
+	FRAMER_PACKET,
+	FRAMER_RESPONSE,
+};
+
+void wacom_v_framer_init(struct wacom_v_framer *fr)
+{
+	memset(fr, 0, sizeof(*fr));
+	fr->state = FRAMER_IDLE;
+}
+
+/* Throw away a partial packet or response, keeping the range and the
+ * drop counters. */
+void wacom_v_framer_reset(struct wacom_v_framer *fr)
+{
+	fr->state = FRAMER_IDLE;
+	fr->idx = 0;
+	fr->line_error = 0;
+}
+
+static void framer_drop(struct wacom_v_framer *fr,
+			enum wacom_v_drop_reason reason)
+{
+	fr->drops[reason]++;
+	fr->state = FRAMER_IDLE;
+}
+
+/* Only packets with the proximity bit set carry coordinates. */
+static int packet_in_range(const struct wacom_v_framer *fr,
+			   const unsigned char *data)
+{
+	int x, y;
+
+	switch (packet_classes[data[0]].type) {
+	case PACKET_GENERAL_STYLUS:
+	case PACKET_FIRST_CURSOR:
+	case PACKET_SECOND_CURSOR:
+		if (!(data[0] & PROXIMITY_BIT))
+			return 1;
+		break;
+	default:
+		return 1;
+	}
+
+	x = ((data[1] & 0x7f) << 9) |
+	    ((data[2] & 0x7f) << 2) |
+	    ((data[3] & 0x60) >> 5);
+	y = ((data[3] & 0x1f) << 11) |
+	    ((data[4] & 0x7f) <<  4) |
+	    ((data[5] & 0x78) >>  3);
+
+	return (!fr->max_x || x <= fr->max_x) &&
+	       (!fr->max_y || y <= fr->max_y);
+}
+
+/* Feed one byte from the line. We're either expecting a carriage
+ * return-terminated ASCII response string starting with a '~', or a
+ * PACKET_LENGTH byte packet with the MSB set on the first byte and on none
+ * of the others. A header byte always starts a new packet, so we are back
+ * in sync one byte after any corruption. line_error is set if the serial
+ * port flagged a parity or framing error on this byte. */
+enum wacom_v_framer_result wacom_v_framer_feed(struct wacom_v_framer *fr,
+					       unsigned char c,
+					       int line_error)
+{
+	if (c & 0x80) {
+		if (fr->state == FRAMER_PACKET)
+			fr->drops[WACOM_V_DROP_TRUNCATED]++;
+		else if (fr->state == FRAMER_RESPONSE)
+			fr->drops[WACOM_V_DROP_BAD_RESPONSE]++;
+		fr->state = FRAMER_PACKET;
+		fr->data[0] = c;
+		fr->idx = 1;
+		fr->line_error = line_error;
+		return WACOM_V_NOTHING;
+	}
+
+	switch (fr->state) {
+	case FRAMER_IDLE:
+		if (c != '~') {
+			fr->drops[WACOM_V_DROP_GARBAGE]++;
+			return WACOM_V_NOTHING;
+		}
+		fr->state = FRAMER_RESPONSE;
+		fr->data[0] = c;
+		fr->idx = 1;
+		fr->line_error = line_error;
+		return WACOM_V_NOTHING;
+
+	case FRAMER_PACKET:
+		fr->data[fr->idx++] = c;
+		fr->line_error |= line_error;
+		if (fr->idx < PACKET_LENGTH)
+			return WACOM_V_NOTHING;
+
+		if (fr->line_error) {
+			framer_drop(fr, WACOM_V_DROP_LINE_ERROR);
+			return WACOM_V_NOTHING;
+		}
+		if (!packet_in_range(fr, fr->data)) {
+			framer_drop(fr, WACOM_V_DROP_OUT_OF_RANGE);
+			return WACOM_V_NOTHING;
+		}
+		fr->state = FRAMER_IDLE;
+		return WACOM_V_PACKET;
+
+	case FRAMER_RESPONSE:
+		fr->line_error |= line_error;
+		if (c == '\r') {
+			if (fr->line_error) {
+				framer_drop(fr, WACOM_V_DROP_LINE_ERROR);
+				return WACOM_V_NOTHING;
+			}
+			fr->data[fr->idx] = 0;
+			fr->state = FRAMER_IDLE;
+			return WACOM_V_RESPONSE;
+		}
+		/* Keep room for the terminating NUL */
+		if (fr->idx >= WACOM_V_MAX_RESPONSE - 1) {
+			framer_drop(fr, WACOM_V_DROP_BAD_RESPONSE);
+			return WACOM_V_NOTHING;
+		}
+		fr->data[fr->idx++] = c;
+		return WACOM_V_NOTHING;
+	}
+
+	return WACOM_V_NOTHING;
+}
+
+/* Parse a response from the framer, data is NUL terminated at len. The
+ * tablet can send anything here, so everything is checked: -EINVAL means
+ * the response was garbled or did not make sense, resp->type is valid
+ * whenever len allows. The positions in a packet are 16 bits wide, so
+ * are the maximum coordinates. */
+int wacom_v_parse_response(const char *data, int len,
+			   struct wacom_v_response *resp)
+{
+	const char *p;
+	unsigned int skip;
+
+	memset(resp, 0, sizeof(*resp));
+	if (len < 2 || data[0] != '~')
+		return -EINVAL;
+	resp->type = data[1];
+
+	switch (resp->type) {
+	case '#':
+		/* eg. "~#GD-1212-R V1.1-5" */
+		if (len < 4)
+			return -EINVAL;
+		resp->model = data[2] << 8 | data[3];
+		p = strrchr(data, 'V');
+		if (p && sscanf(p + 1, "%u.%u", &resp->major_v,
+				&resp->minor_v) != 2)
+			resp->major_v = resp->minor_v = 0;
+		return 0;
+
+	case 'C':
+		if (sscanf(data, "~C%u,%u", &resp->max_x, &resp->max_y) != 2 ||
+		    !resp->max_x || resp->max_x > POSITION_MAX ||
+		    !resp->max_y || resp->max_y > POSITION_MAX)
+			return -EINVAL;
+		return 0;
+
+	case 'R':
+		if (sscanf(data, "~R%x,%u,%u,%u,%u", &skip, &skip, &skip,
+			   &resp->res_x, &resp->res_y) != 5 ||
+		    !resp->res_x || resp->res_x > POSITION_MAX ||
+		    !resp->res_y || resp->res_y > POSITION_MAX)
+			return -EINVAL;
+		return 0;
+	}
+
+	return 0;
+}
+
+/* Checks an area and computes its multipliers. Zero maxima become the
+ * size of the (rotated) area, so it is clipped but not scaled. */
+int wacom_v_area_update(struct wacom_v_area *area)
+{
+	int w = area->x1 - area->x0, h = area->y1 - area->y0;
+	int rw, rh;
+
+	if (area->x0 < 0 || area->y0 < 0 || w <= 0 || h <= 0 ||
+	    area->x1 > POSITION_MAX || area->y1 > POSITION_MAX)
+		return -EINVAL;
+
+	switch (area->rotation) {
+	case 0:
+	case 180:
+		rw = w;
+		rh = h;
+		break;
+	case 90:
+	case 270:
+		rw = h;
+		rh = w;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!area->max_x)
+		area->max_x = rw;
+	if (!area->max_y)
+		area->max_y = rh;
+	if (area->max_x < 0 || area->max_x > POSITION_MAX ||
+	    area->max_y < 0 || area->max_y > POSITION_MAX)
+		return -EINVAL;
+
+	area->scale_x = ((__u32)area->max_x << WACOM_V_FIXED_SHIFT) / rw;
+	area->scale_y = ((__u32)area->max_y << WACOM_V_FIXED_SHIFT) / rh;
+	return 0;
+}
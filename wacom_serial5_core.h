@@ -0,0 +1,255 @@
+/*
+ * Wacom protocol 5 packet decoder
+ *
+ * This is the part of the protocol 5 driver that turns raw 9-byte packets
+ * into input events. It does not talk to the input core itself: every
+ * decoded packet is written to a struct wacom_v_frame, which the caller
+ * then pushes into an input device (see wacom_serial5_drv.c) or simply
+ * counts (see tools/wacom_v_bench.c).
+ *
+ * Keep this file and wacom_serial5_core.c free of anything that is not
+ * available in both the kernel and in userspace, so the decoder can be
+ * profiled and tested without a tablet (or a kernel) at hand.
+ */
+
+#ifndef _WACOM_SERIAL5_CORE_H
+#define _WACOM_SERIAL5_CORE_H
+
+#include <linux/types.h>
+#include <linux/input.h>
+
+#define PACKET_LENGTH 9
+
+#define MAX_Z ((1 << 10) - 1)
+
+#define TILT_SIGN_BIT   0x40
+#define TILT_BITS       0x3F
+#define PROXIMITY_BIT   0x40
+
+#if 0
+/* device IDs from wacom_wac.h */
+//TODO: properly include this header!
+#define STYLUS_DEVICE_ID	0x02
+#define TOUCH_DEVICE_ID         0x03
+#define CURSOR_DEVICE_ID        0x06
+#define ERASER_DEVICE_ID        0x0A
+#define PAD_DEVICE_ID           0x0F
+#endif
+
+struct wacom_v_tool_ops;
+
+/* Key codes from SHADOW_KEY_BASE up to SHADOW_KEY_BASE + SHADOW_KEY_BITS
+ * are shadowed, this covers all the buttons and tools we report. */
+#define SHADOW_KEY_BASE		BTN_MISC
+#define SHADOW_KEY_BITS		96
+#define SHADOW_KEY_WORDS	(SHADOW_KEY_BITS / 32)
+
+/* The values last reported to the input device for a channel, so we only
+ * have to report what changed. A value is only valid if its bit in the
+ * corresponding *_valid mask is set. */
+struct wacom_v_shadow {
+	__u64 abs_valid;
+	__s32 abs[ABS_CNT];
+	__u32 keys_valid[SHADOW_KEY_WORDS];
+	__u32 keys[SHADOW_KEY_WORDS];
+	int serial_valid;
+	__u32 serial_num;
+	int tool;
+};
+
+/* Motion filter and predictor, see track_frame() */
+enum wacom_v_tracked_axis {
+	TRACK_X,
+	TRACK_Y,
+	TRACK_PRESSURE,
+	TRACK_AXES
+};
+
+struct wacom_v_tracker {
+	int valid;		/* pos and vel hold anything */
+	int pos[TRACK_AXES];	/* filtered position, 24.8 fixed point */
+	int vel[TRACK_AXES];	/* per packet, 24.8 fixed point */
+};
+
+struct tool_state {
+	int tool;		/* BTN_TOOL_XXX */
+	int tool_id;		/* tool ID as received by hardware */
+	const struct wacom_v_tool_ops *ops; /* resolved from tool_id */
+	int device_id;		/* device type *_DEVICE_ID */
+	__u32 serial_num;	/* tool serial# as received by hardware */
+	int proximity;
+	int channel;		/* index in wacom_v_decoder.tool_state */
+	__s64 scroll;		/* 4D mouse scroll, 16.16 hi-res units */
+	int wheel;		/* hi-res units towards the next click */
+	struct wacom_v_tracker tracker;
+	struct wacom_v_shadow shadow;
+};
+
+/* Thumbwheel configuration for the 4D mouse. Every tablet has its own,
+ * the driver exposes them as attributes of the serio device. */
+struct wacom_v_params {
+	int thumbwheel;		/* out: last decoded thumbwheel value */
+	int th_mode;
+	int pos_delay;
+	int neg_delay;
+	int deadband;
+	int thumbwheel_offset;
+	int scroll_accel;	/* percent, 0 to 1000 */
+	int filter;		/* filter and predict X, Y and pressure */
+	int filter_alpha;	/* position gain, 1 to 256 (= raw) */
+	int filter_beta;	/* velocity gain, 0 to 256 */
+	int predict;		/* percent of a packet interval, 0 to 400 */
+
+	/* Derived from the above by wacom_v_params_update(), call that
+	 * after changing them. Updates may run while a packet is decoded:
+	 * the decoder reads each of these once per use. */
+	int pos_scale;		/* 16.16 hi-res units per throttle unit */
+	int neg_scale;
+	int accel_scale;	/* 8.24 extra gain per throttle unit */
+	int horizon;		/* predict, packets in 24.8 fixed point */
+};
+
+#define WACOM_V_FIXED_SHIFT	16
+#define WACOM_V_FIXED_ONE	(1 << WACOM_V_FIXED_SHIFT)
+#define WACOM_V_HIRES_PER_CLICK	120
+
+#ifndef REL_WHEEL_HI_RES
+#define REL_WHEEL_HI_RES	0x0b
+#endif
+
+enum packet_type {
+	PACKET_UNKNOWN = 0,
+	PACKET_DEVICE_ID,
+	PACKET_OUT_OF_PROXIMITY,
+	PACKET_GENERAL_STYLUS,
+	PACKET_FIRST_CURSOR,
+	PACKET_SECOND_CURSOR,
+	PACKET_NUM_TYPES
+};
+
+extern const char *const wacom_v_packet_type_names[PACKET_NUM_TYPES];
+
+struct wacom_v_event {
+	__u16 type;		/* EV_XXX */
+	__u16 code;
+	__s32 value;
+};
+
+/* More than enough for the largest packet (an out of proximity reset of a
+ * mouse). */
+#define WACOM_V_MAX_EVENTS 32
+
+struct wacom_v_frame {
+	int nevents;
+	struct wacom_v_event events[WACOM_V_MAX_EVENTS];
+};
+
+/* Pressure curves, one per kind of stylus, see map_pressure() */
+enum wacom_v_pressure_tool {
+	WACOM_V_PRESSURE_PEN,
+	WACOM_V_PRESSURE_PENCIL,
+	WACOM_V_PRESSURE_BRUSH,
+	WACOM_V_PRESSURE_AIRBRUSH,
+	WACOM_V_PRESSURE_RUBBER,
+	WACOM_V_PRESSURE_TOOLS
+};
+
+struct wacom_v_pressure_lut {
+	__u16 z[MAX_Z + 1];	/* reported per raw pressure, up to MAX_Z */
+};
+
+#ifndef __rcu
+#define __rcu
+#endif
+
+/* Active area and orientation: positions are clipped to the area,
+ * rotated and scaled to 0 to max_x/max_y, see map_position(). */
+struct wacom_v_area {
+	int x0, y0, x1, y1;	/* on the tablet, x0 < x1 and y0 < y1 */
+	int rotation;		/* clockwise, 0, 90, 180 or 270 degrees */
+	int max_x, max_y;	/* after rotating, 0 for the area's size */
+
+	/* Derived from the above by wacom_v_area_update() */
+	__u32 scale_x, scale_y;	/* 16.16, reported units per tablet unit */
+};
+
+struct wacom_v_decoder {
+	struct tool_state tool_state[2]; /* state per channel */
+	/* NULL for the raw pressure. Replaced with RCU by the driver. */
+	struct wacom_v_pressure_lut __rcu *pressure[WACOM_V_PRESSURE_TOOLS];
+	struct wacom_v_params *params;
+	unsigned long packets[PACKET_NUM_TYPES]; /* seen, per packet type */
+	int shadow_channel;	/* channel that reported last, or -1 */
+	int separate_devices;	/* each channel has its own input device */
+	int max_x, max_y;	/* the predictor stays within, 0 for any */
+	/* NULL for raw positions. Replaced with RCU by the driver. */
+	struct wacom_v_area __rcu *area;
+	const struct wacom_v_area *cur_area; /* during decoding */
+};
+
+/* Why the framer threw bytes away, see struct wacom_v_framer. */
+enum wacom_v_drop_reason {
+	WACOM_V_DROP_GARBAGE,		/* bytes outside a packet/response */
+	WACOM_V_DROP_TRUNCATED,		/* packet cut short by a header */
+	WACOM_V_DROP_LINE_ERROR,	/* parity or framing error */
+	WACOM_V_DROP_OUT_OF_RANGE,	/* coordinates beyond the maximum */
+	WACOM_V_DROP_BAD_RESPONSE,	/* response too long or cut short */
+	WACOM_V_NUM_DROP_REASONS
+};
+
+#define WACOM_V_MAX_RESPONSE 32
+
+/* Splits the byte stream from the tablet into packets and command
+ * responses. */
+struct wacom_v_framer {
+	int state;
+	int idx;
+	int line_error;		/* seen in the current packet/response */
+	unsigned char data[WACOM_V_MAX_RESPONSE];
+	int max_x, max_y;	/* for the range check, 0 to disable */
+	unsigned long drops[WACOM_V_NUM_DROP_REASONS];
+};
+
+enum wacom_v_framer_result {
+	WACOM_V_NOTHING,	/* need more bytes */
+	WACOM_V_PACKET,		/* PACKET_LENGTH bytes in data */
+	WACOM_V_RESPONSE,	/* NUL terminated string in data, length idx */
+};
+
+void wacom_v_framer_init(struct wacom_v_framer *fr);
+void wacom_v_framer_reset(struct wacom_v_framer *fr);
+enum wacom_v_framer_result wacom_v_framer_feed(struct wacom_v_framer *fr,
+					       unsigned char c,
+					       int line_error);
+
+enum wacom_v_result {
+	WACOM_V_FRAME,		/* frame holds events, follow with a sync */
+	WACOM_V_IGNORED,	/* nothing to report */
+	WACOM_V_UNKNOWN,	/* unknown packet type */
+};
+
+/* The answers to the setup requests, see wacom_v_parse_response(). Only
+ * the fields for the request in type are filled in. */
+struct wacom_v_response {
+	char type;		/* '#', 'C', 'R' or whatever else came back */
+	int model;		/* '#': the two letters after "~#" */
+	unsigned int major_v, minor_v;
+	unsigned int max_x, max_y;	/* 'C' */
+	unsigned int res_x, res_y;	/* 'R', lines per inch */
+};
+
+int wacom_v_parse_response(const char *data, int len,
+			   struct wacom_v_response *resp);
+
+int wacom_v_area_update(struct wacom_v_area *area);
+void wacom_v_params_update(struct wacom_v_params *params);
+void wacom_v_decoder_init(struct wacom_v_decoder *dec,
+			  struct wacom_v_params *params);
+enum wacom_v_result wacom_v_decode_packet(struct wacom_v_decoder *dec,
+					  const unsigned char *data,
+					  struct wacom_v_frame *frame);
+enum wacom_v_result wacom_v_decoder_release(struct wacom_v_decoder *dec,
+					    int channel,
+					    struct wacom_v_frame *frame);
+
+#endif /* _WACOM_SERIAL5_CORE_H */
@@ -0,0 +1,2765 @@
+/*
+ * Wacom protocol 5 serial tablet driver
+ *
+ * This code is based on the Wacom protocol 4 serial tablet driver by 
+ * Julian Squires <julian@cipht.net>.
+ *
+ * Protocol 5 is implemented by Roald Frederickx 
+ * <roald.frederickx@gmail.com>.
+ *
+ *
+ * This driver was developed with reference to much code written by others,
+ * particularly:
+ *  - wacom protocol 4 serial tablet driver by Julian Squires 
+ *    <julian@cipht.net>;
+ *  - elo, gunze drivers by Vojtech Pavlik <vojtech@ucw.cz>;
+ *  - wacom_w8001 driver by Jaya Kumar <jayakumar.lkml@gmail.com>;
+ *  - the USB wacom input driver, credited to many people
+ *    (see drivers/input/tablet/wacom.h);
+ *  - new and old versions of linuxwacom / xf86-input-wacom credited to
+ *    Frederic Lepied, France. <Lepied@XFree86.org> and
+ *    Ping Cheng, Wacom. <pingc@wacom.com>;
+ *    For reference:
+ *      * The last tree of xf86-input-wacom that still has the serial code:
+ *        f0c8aa9962e0238557d103baa4a5ba57484fd1c9
+ *      * The commit that removed serial support:
+ *        b3cba4e3543a98103282ba8fa55bf38012d23d9f
+ *  - and xf86wacom.c (a presumably ancient version of the linuxwacom 
+ *    code), by Frederic Lepied and Raph Levien <raph@gtk.org>.
+ */
+
+#include <linux/string.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/input.h>
+#include <linux/input/mt.h>
+#include <linux/serio.h>
+#include <linux/slab.h>
+#include <linux/jiffies.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/tty.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/jump_label.h>
+#include <linux/version.h>
+
+#include "wacom_serial5_core.h"
+#include "wacom_serial5_ring.h"
+
+#define CREATE_TRACE_POINTS
+#include "wacom_serial5_trace.h"
+
+/* XXX To be removed before (widespread) release. */
+#ifndef SERIO_WACOM_V
+#define SERIO_WACOM_V 0x3e
+#endif
+
+/* hrtimer_setup() took over from hrtimer_init() in 6.13 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+
+/* TODO copied from the kernel's wacom.h for now */
+#define USB_VENDOR_ID_WACOM	0x056a
+
+
+#define DRIVER_AUTHOR	"Roald Frederickx <roald.frederickx@gmail.com>"
+#define DEVICE_NAME	"Wacom protocol 5 serial tablet"
+#define DRIVER_DESC	DEVICE_NAME " driver"
+#define DRIVER_NAME	"wacom_serial5"
+
+MODULE_AUTHOR(DRIVER_AUTHOR);
+MODULE_DESCRIPTION(DRIVER_DESC);
+MODULE_LICENSE("GPL");
+// module paramaters for thumbwheel configuration, the defaults for every
+// tablet connected afterwards (see the attributes of the serio device)
+static struct wacom_v_params params = {
+	.th_mode = 0, // default to scroll mode
+	.pos_delay = 800,
+	.neg_delay = -800,
+	.filter_alpha = 128,
+	.filter_beta = 43,
+	.predict = 100,
+};
+module_param_named(th_mode, params.th_mode, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(th_mode, "Set to 1 to act as absolute thumbwheel, 0 for relative scroll");
+module_param_named(pos_delay, params.pos_delay, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(pos_delay, "Positive delay limit");
+module_param_named(neg_delay, params.neg_delay, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(neg_delay, "Negative delay limit");
+module_param_named(deadband, params.deadband, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(deadband, "Minimum value from offset that will get an action");
+module_param_named(thumbwheel_offset, params.thumbwheel_offset, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(thumbwheel_offset, "Compensate for thumbwheel that returns to offset value");
+module_param_named(scroll_accel, params.scroll_accel, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(scroll_accel, "Percent faster scrolling at full thumbwheel deflection (0-1000)");
+module_param_named(filter, params.filter, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(filter, "Set to 1 to smooth and predict positions and pressure");
+module_param_named(filter_alpha, params.filter_alpha, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(filter_alpha, "Position gain of the filter (1-256, 256 = raw positions)");
+module_param_named(filter_beta, params.filter_beta, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(filter_beta, "Velocity gain of the filter (0-256)");
+module_param_named(predict, params.predict, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(predict, "How far ahead to predict, in percent of a packet interval (0-400)");
+
+/* The values the parameters above may take, as module parameters as well
+ * as attributes of each tablet: the decoder multiplies with some of them
+ * and overflows beyond. */
+#define WACOM_PARAMS(P)					\
+	P(th_mode,		0,		1)	\
+	P(pos_delay,		1,		INT_MAX) \
+	P(neg_delay,		INT_MIN,	-1)	\
+	P(deadband,		0,		INT_MAX) \
+	P(thumbwheel_offset,	-1023,		1023)	\
+	P(scroll_accel,		0,		1000)	\
+	P(filter,		0,		1)	\
+	P(filter_alpha,		1,		256)	\
+	P(filter_beta,		0,		256)	\
+	P(predict,		0,		400)
+
+#define PARAM_CLAMP(_name, _min, _max)					\
+	if (p->_name < (_min) || p->_name > (_max)) {			\
+		pr_warn(DRIVER_NAME ": " #_name " %d out of range, "	\
+			"using %d\n", p->_name,				\
+			clamp(p->_name, _min, _max));			\
+		p->_name = clamp(p->_name, _min, _max);			\
+	}
+
+/* The module parameters can be set to anything when loading or later on,
+ * pull them back into range before a tablet gets them. */
+static void wacom_params_clamp(struct wacom_v_params *p)
+{
+	WACOM_PARAMS(PARAM_CLAMP)
+}
+
+static bool deferred = false;
+module_param(deferred, bool, S_IRUGO);
+MODULE_PARM_DESC(deferred, "Only frame bytes in the interrupt handler and decode packets from a work item");
+
+static bool split_channels = false;
+module_param(split_channels, bool, S_IRUGO);
+MODULE_PARM_DESC(split_channels, "Report the two tools a tablet can track at once through separate input devices (otherwise their events interleave on one)");
+
+static unsigned int coalesce_us = 0;
+module_param(coalesce_us, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(coalesce_us, "Default minimum time between two reports of a tablet (us, 0 reports every packet)");
+
+static unsigned int setup_timeout = 1000;
+module_param(setup_timeout, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(setup_timeout, "Time to wait for each response of the tablet during setup (ms)");
+
+static unsigned int setup_retries = 2;
+module_param(setup_retries, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(setup_retries, "Number of times a request is retried during setup");
+
+static bool cache_profiles = true;
+module_param(cache_profiles, bool, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+MODULE_PARM_DESC(cache_profiles, "Bring a tablet up at once from what it told us last time on the same port");
+
+static int ldisc = 0;
+module_param(ldisc, int, S_IRUGO);
+MODULE_PARM_DESC(ldisc, "Register a line discipline of our own under this number (eg. 29, N_DEVELOPMENT) that hands whole chunks from the tty to the driver, 0 for none");
+
+
+#define REQUEST_MODEL_AND_ROM_VERSION	"~#\r"
+#define REQUEST_MAX_COORDINATES		"~C\r"
+#define REQUEST_CONFIGURATION_STRING	"~R\r"
+#define REQUEST_RESET_TO_PROTOCOL_IV	"\r#\r"
+
+#define COMMAND_START_SENDING_PACKETS		"ST\r"
+#define COMMAND_STOP_SENDING_PACKETS		"SP\r"
+#define COMMAND_SINGLE_MODE_INPUT		"MT0\r"
+#define COMMAND_MULTI_MODE_INPUT		"MT1\r" /* MU1 for protocol4 */
+
+#define COMMAND_ORIGIN_IN_UPPER_LEFT		"OC1\r"
+#define COMMAND_ENABLE_ALL_MACRO_BUTTONS	"~M0\r"
+#define COMMAND_DISABLE_GROUP_1_MACRO_BUTTONS	"~M1\r"
+#define COMMAND_TRANSMIT_AT_MAX_RATE		"IT0\r"
+#define COMMAND_DISABLE_INCREMENTAL_MODE	"IN0\r"
+#define COMMAND_ENABLE_CONTINUOUS_MODE		"SR\r"
+#define COMMAND_ENABLE_PRESSURE_MODE		"PH1\r"
+#define COMMAND_Z_FILTER			"ZF1\r"
+
+/* With an argument, for the tablet settings attributes */
+#define COMMAND_INTERVAL_FMT			"IT%d\r"
+#define COMMAND_Z_FILTER_FMT			"ZF%d\r"
+#define COMMAND_MULTI_MODE_FMT			"MT%d\r"
+
+/* Link speed negotiated by inputattach (see inputattach.patch), passed to
+ * us in serio->id.extra. */
+static const unsigned int link_speeds[] = {
+	0,	/* unknown: an inputattach that doesn't tell us */
+	9600,
+	19200,
+	38400,
+};
+
+#define COMMAND_HEIGHT				"HT1\r"
+#define COMMAND_ID				"ID1\r"
+
+/* A complete packet or response, as handed from the interrupt handler to
+ * the work item in deferred mode. */
+struct wacom_rx_record {
+	ktime_t time;		/* packet_time(), or first byte of a response */
+	ktime_t arrival;	/* first byte */
+	int len;
+	unsigned char data[WACOM_V_MAX_RESPONSE];
+};
+
+#define RX_RING_SIZE 64	/* must be a power of two */
+
+/* A command for the tablet, queued by wacom_queue_command() */
+struct wacom_cmd {
+	char text[8];		/* NUL terminated, including the \r */
+	char response;		/* second character of the response to wait
+				 * for, 0 if the command has none */
+	bool confirm;		/* asked by wacom_confirm_profile() */
+};
+
+#define CMD_QUEUE_SIZE 16	/* must be a power of two */
+
+/* A pressure curve loaded through the pressure attributes */
+struct wacom_pressure_curve {
+	struct rcu_head rcu;
+	struct wacom_v_pressure_lut lut;
+};
+
+/* An active area set through the area attribute */
+struct wacom_area {
+	struct rcu_head rcu;
+	struct wacom_v_area area;
+};
+
+/* The packet ring of a tablet, see wacom_serial5_ring.h. Allocated when
+ * the character device is opened, freed when the last mapping of it is
+ * gone. The reader can write anything to the mapping, so the driver
+ * keeps its own head and lost and never reads back anything but tail. */
+struct wacom_ring {
+	struct wacom *wacom;	/* NULL once the tablet is gone, ring_lock */
+	struct wacom_v_ring_header *header;
+	struct wacom_v_ring_record *records;
+	u32 head;
+	u32 lost;
+	u8 flags;		/* for the next record */
+	/* framer drops already flagged, see ring_packet() */
+	unsigned long drops[WACOM_V_NUM_DROP_REASONS];
+	wait_queue_head_t wait;
+};
+
+#define RING_RECORDS 4096	/* must be a power of two */
+
+/* Serialises opening and closing rings against the tablet going away */
+static DEFINE_MUTEX(ring_lock);
+
+/* Any ring open at all: keeps the check out of the packet path otherwise */
+static DEFINE_STATIC_KEY_FALSE(ring_active);
+
+/* What the pressure attributes read back without a curve */
+static struct wacom_v_pressure_lut linear_pressure;
+
+/* The handshake with the tablet, done from wacom->setup_work after
+ * connecting. Every step sends a request and waits for the response. */
+enum setup_step {
+	SETUP_MODEL,
+	SETUP_COORDINATES,
+	SETUP_CONFIGURATION,
+	SETUP_DONE,
+	SETUP_FAILED,
+};
+
+static const struct {
+	const char *name;
+	const char *request;
+	char response;		/* second character of the response */
+	bool required;		/* give up if the tablet doesn't answer */
+} setup_steps[SETUP_DONE] = {
+	[SETUP_MODEL] = {
+		"model", REQUEST_MODEL_AND_ROM_VERSION, '#', true
+	},
+	[SETUP_COORDINATES] = {
+		"coordinates", REQUEST_MAX_COORDINATES, 'C', false
+	},
+	[SETUP_CONFIGURATION] = {
+		"configuration", REQUEST_CONFIGURATION_STRING, 'R', false
+	},
+};
+
+/* What a tablet told us about itself during setup, one response per
+ * setup step (type 0 if it never answered). */
+struct wacom_profile {
+	struct wacom_v_response responses[SETUP_DONE];
+	char text[SETUP_DONE][WACOM_V_MAX_RESPONSE];	/* as received */
+};
+
+/* The profiles of the tablets set up so far, by serio->phys, see
+ * wacom_setup_from_profile(). */
+struct wacom_profile_entry {
+	struct list_head list;
+	char phys[sizeof(((struct serio *)0)->phys)];
+	struct wacom_profile profile;
+};
+
+static LIST_HEAD(profile_cache);
+static DEFINE_MUTEX(profile_lock);
+
+#define HIST_BUCKETS 24
+
+/* Runtime statistics. Each counter has one writer at a time, so no
+ * locking: the receive side (bytes, the packet rate, interval_hist) is
+ * only written from the interrupt handler, the command counters from
+ * setup_work until the setup is done and from cmd_work after that,
+ * merged_frames under pending_lock. Frames go out from the interrupt
+ * handler or rx_work and from the coalesce timer at the same time,
+ * which is why latency_hist is atomic. */
+struct wacom_stats {
+	unsigned long bytes;		/* received */
+	unsigned long command_timeouts;
+	unsigned long commands;		/* sent through the command queue */
+	unsigned long reconnects;	/* see wacom_reconnect() */
+	ktime_t last_packet;		/* first byte of the last packet */
+	unsigned long rate_start;	/* jiffies */
+	unsigned long rate_count;	/* packets since rate_start */
+	unsigned long rate;		/* packets per second */
+	unsigned long merged_frames;	/* coalesced into another one */
+	/* log2 histograms in us: bucket 0 counts everything below 1 us,
+	 * bucket n from 2^(n-1) up to 2^n us, the last one everything
+	 * beyond that. */
+	unsigned long interval_hist[HIST_BUCKETS]; /* between packets */
+	atomic_long_t latency_hist[HIST_BUCKETS];  /* first byte to sync */
+};
+
+/* Sample times of the packets, see packet_time() */
+struct wacom_clock {
+	ktime_t last;		/* time given to the last packet */
+	s64 period;		/* estimated time between packets, ns */
+	s64 min_period;		/* time to send a packet over the line, ns */
+	s64 byte_time;		/* time to send a byte over the line, ns */
+};
+
+struct wacom {
+	struct input_dev *dev;	/* of channel 0 */
+	/* The input device each channel reports to: dev for both, unless
+	 * split, then channel 1 has one of its own. */
+	struct input_dev *channel_dev[2];
+	bool split;
+	struct serio *serio;
+	int registered;		/* input devices registered, all: setup done */
+	struct wacom_v_framer framer;
+	ktime_t rx_start;	/* first byte of the current packet */
+	struct wacom_clock clock;
+	struct wacom_v_decoder decoder;
+	struct wacom_v_params params;	/* used by the decoder */
+	bool rx_stopped;		/* drop everything, see wacom_stop() */
+	struct mutex config_lock;	/* serialises params,
+					 * decoder.pressure and
+					 * decoder.area updates */
+	int res_x, res_y;		/* of the tablet, see the ~R response */
+
+	/* Coalescing, see coalesce_frame(). pending_lock protects pending
+	 * and last_sync against the timer. */
+	unsigned int coalesce_us;
+	spinlock_t pending_lock;
+	struct wacom_v_frame pending;
+	int pending_channel;
+	ktime_t pending_time;	/* of the newest packet in it */
+	ktime_t pending_arrival; /* first byte of the oldest one */
+	ktime_t last_sync;
+	struct hrtimer coalesce_timer;
+	struct wacom_v_frame frame;
+
+	/* Deferred mode: the interrupt handler is the only producer and
+	 * rx_work the only consumer of rx_ring, so no locking is needed. */
+	bool deferred;
+	DECLARE_KFIFO(rx_ring, struct wacom_rx_record, RX_RING_SIZE);
+	struct work_struct rx_work;
+	unsigned long rx_overflows;	/* records dropped, ring was full */
+	unsigned int rx_high_water;	/* maximum ring fill level seen */
+
+	struct delayed_work setup_work;
+	enum setup_step setup_step;
+	unsigned int setup_tries;	/* requests sent for this step */
+	char setup_response;		/* set by handle_response */
+	ktime_t setup_start;		/* of the whole handshake */
+	ktime_t step_start;		/* of the last request */
+	s64 setup_us[SETUP_DONE];	/* time each step took */
+	s64 setup_total_us;
+	struct wacom_profile profile;	/* filled in by handle_response */
+	bool profile_cached;		/* set up from profile_cache */
+	bool profile_stale;		/* the tablet disagrees with it */
+	bool profile_dirty;		/* changed since profile_store() */
+	bool range_dirty;		/* see position_range_changed() */
+
+	/* Commands sent once the tablet is set up, see wacom_cmd_work().
+	 * cmd_lock serialises the producers, cmd_work is the only
+	 * consumer of cmd_queue and the only one to touch cmd. */
+	struct mutex cmd_lock;
+	DECLARE_KFIFO(cmd_queue, struct wacom_cmd, CMD_QUEUE_SIZE);
+	struct delayed_work cmd_work;
+	struct wacom_cmd cmd;		/* waiting for its response */
+	ktime_t cmd_start;		/* when cmd was sent */
+	char cmd_response;		/* set by handle_response */
+	bool cmd_confirming;		/* cmd.confirm, for handle_response */
+	/* What the tablet settings attributes were last set to, -1 for
+	 * the tablet's default. Protected by cmd_lock. */
+	int report_interval;
+	int z_filter;
+	int multi_mode;
+	int streaming;
+	char configuration[WACOM_V_MAX_RESPONSE]; /* last "~R" response */
+
+	/* The packet ring. ring is only set and cleared with rx paused,
+	 * and under ring_lock. */
+	struct miscdevice ring_misc;
+	char ring_name[32];
+	struct wacom_ring *ring;
+
+	struct wacom_stats stats;
+};
+
+#define for_each_input_dev(wacom, i, input_dev)				\
+	for ((i) = 0; (i) < ((wacom)->split ? 2 : 1) &&			\
+		      ((input_dev) = (wacom)->channel_dev[i]); (i)++)
+
+enum {
+	MODEL_INTUOS		= 0x4744, /* GD */
+	MODEL_INTUOS2		= 0x5844, /* XD */
+	MODEL_UNKNOWN           = 0
+};
+
+static void handle_model_response(struct wacom *wacom, const char *data,
+				  const struct wacom_v_response *resp)
+{
+	struct input_dev *input_dev;
+	int version, i;
+	const char *p;
+
+	dev_dbg(&wacom->dev->dev, "Model string: %s\n", data);
+
+	switch (resp->model) {
+	case MODEL_INTUOS:
+		p = "Intuos";
+		version = MODEL_INTUOS;
+		break;
+	case MODEL_INTUOS2:
+		p = "Intuos2";
+		version = MODEL_INTUOS2;
+		break;
+	default:
+		dev_dbg(&wacom->dev->dev, "Didn't understand Wacom model "
+				"string: \"%s\". Maybe you want the "
+				"protocol IV driver instead of this one?\n",
+				data);
+		p = "Unknown Protocol V";
+		version = MODEL_UNKNOWN;
+		break;
+	}
+	dev_info(&wacom->dev->dev, "Wacom tablet: %s, version %u.%u\n", p,
+		 resp->major_v, resp->minor_v);
+	for_each_input_dev(wacom, i, input_dev) {
+		input_dev->id.version = version;
+		input_set_abs_params(input_dev, ABS_PRESSURE, 0, MAX_Z, 0, 0);
+		/* XXX Report from 0 to 2 * TILT_BITS + 1 until upstream is
+		 * fixed. Also see comment below when sending the data. */
+		input_set_abs_params(input_dev, ABS_TILT_X,
+						0, 2 * TILT_BITS + 1, 0, 0);
+						//-(TILT_BITS + 1), TILT_BITS, 0, 0);
+		input_set_abs_params(input_dev, ABS_TILT_Y,
+						0, 2 * TILT_BITS + 1, 0, 0);
+						//-(TILT_BITS + 1), TILT_BITS, 0, 0);
+	}
+}
+
+
+/* Sets the range and resolution of ABS_X and ABS_Y to those of the
+ * tablet, or of the active area if there is one. Nothing but the
+ * resolution until the tablet told us its range. The axes themselves are
+ * there from wacom_init_input_dev() on, only their limits change, under
+ * event_lock as the devices may be registered already. Called in process
+ * context with config_lock held. */
+static void update_position_range(struct wacom *wacom)
+{
+	const struct wacom_v_area *area;
+	struct input_dev *input_dev;
+	int max_x, max_y, res_x, res_y, i;
+
+	lockdep_assert_held(&wacom->config_lock);
+	WRITE_ONCE(wacom->range_dirty, false);
+
+	rcu_read_lock();
+	area = rcu_dereference(wacom->decoder.area);
+	if (area) {
+		bool swap = area->rotation == 90 || area->rotation == 270;
+
+		max_x = area->max_x;
+		max_y = area->max_y;
+		res_x = ((u64)(swap ? wacom->res_y : wacom->res_x) *
+			 area->scale_x) >> WACOM_V_FIXED_SHIFT;
+		res_y = ((u64)(swap ? wacom->res_x : wacom->res_y) *
+			 area->scale_y) >> WACOM_V_FIXED_SHIFT;
+	} else {
+		max_x = wacom->decoder.max_x;
+		max_y = wacom->decoder.max_y;
+		res_x = wacom->res_x;
+		res_y = wacom->res_y;
+	}
+	rcu_read_unlock();
+
+	for_each_input_dev(wacom, i, input_dev) {
+		spin_lock_irq(&input_dev->event_lock);
+		if (max_x && max_y) {
+			input_abs_set_max(input_dev, ABS_X, max_x);
+			input_abs_set_max(input_dev, ABS_Y, max_y);
+			if (!wacom->split) {
+				input_abs_set_max(input_dev, ABS_MT_POSITION_X,
+						  max_x);
+				input_abs_set_max(input_dev, ABS_MT_POSITION_Y,
+						  max_y);
+			}
+		}
+		input_abs_set_res(input_dev, ABS_X, res_x);
+		input_abs_set_res(input_dev, ABS_Y, res_y);
+		spin_unlock_irq(&input_dev->event_lock);
+	}
+}
+
+/* The response handlers run in interrupt context: they only note that the
+ * range changed. Until the setup is done, wacom_setup_finish() picks it
+ * up, afterwards wacom_cmd_work(). */
+static void position_range_changed(struct wacom *wacom)
+{
+	WRITE_ONCE(wacom->range_dirty, true);
+	if (wacom->setup_step == SETUP_DONE)
+		mod_delayed_work(system_wq, &wacom->cmd_work, 0);
+}
+
+static void handle_configuration_response(struct wacom *wacom,
+					  const char *data,
+					  const struct wacom_v_response *resp)
+{
+	dev_dbg(&wacom->dev->dev, "Configuration string: %s\n", data);
+	strscpy(wacom->configuration, data, sizeof(wacom->configuration));
+	wacom->res_x = resp->res_x;
+	wacom->res_y = resp->res_y;
+	position_range_changed(wacom);
+}
+
+static void handle_coordinates_response(struct wacom *wacom,
+					const char *data,
+					const struct wacom_v_response *resp)
+{
+	dev_dbg(&wacom->dev->dev, "Coordinates string: %s\n", data);
+
+	/* Packets beyond this are corrupted */
+	wacom->framer.max_x = resp->max_x;
+	wacom->framer.max_y = resp->max_y;
+	wacom->decoder.max_x = resp->max_x;
+	wacom->decoder.max_y = resp->max_y;
+	position_range_changed(wacom);
+}
+
+static struct wacom_profile_entry *profile_find(const char *phys)
+{
+	struct wacom_profile_entry *entry;
+
+	list_for_each_entry(entry, &profile_cache, list)
+		if (!strcmp(entry->phys, phys))
+			return entry;
+	return NULL;
+}
+
+static bool profile_lookup(const char *phys, struct wacom_profile *profile)
+{
+	struct wacom_profile_entry *entry;
+
+	mutex_lock(&profile_lock);
+	entry = profile_find(phys);
+	if (entry)
+		*profile = entry->profile;
+	mutex_unlock(&profile_lock);
+	return entry;
+}
+
+static void profile_store(const char *phys,
+			  const struct wacom_profile *profile)
+{
+	struct wacom_profile_entry *entry;
+
+	mutex_lock(&profile_lock);
+	entry = profile_find(phys);
+	if (!entry) {
+		entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+		if (entry) {
+			strscpy(entry->phys, phys, sizeof(entry->phys));
+			list_add(&entry->list, &profile_cache);
+		}
+	}
+	if (entry)
+		entry->profile = *profile;
+	mutex_unlock(&profile_lock);
+}
+
+static void profile_forget(const char *phys)
+{
+	struct wacom_profile_entry *entry;
+
+	mutex_lock(&profile_lock);
+	entry = profile_find(phys);
+	if (entry) {
+		list_del(&entry->list);
+		kfree(entry);
+	}
+	mutex_unlock(&profile_lock);
+}
+
+static void apply_response(struct wacom *wacom, const char *data,
+			   const struct wacom_v_response *resp)
+{
+	switch (resp->type) {
+	case '#':
+		handle_model_response(wacom, data, resp);
+		break;
+	case 'R':
+		handle_configuration_response(wacom, data, resp);
+		break;
+	case 'C':
+		handle_coordinates_response(wacom, data, resp);
+		break;
+	default:
+		dev_dbg(&wacom->dev->dev, "got an unexpected response: %s\n",
+			data);
+		break;
+	}
+}
+
+/* The setup step whose request the response type answers, or -1 */
+static int profile_index(char type)
+{
+	int i;
+
+	for (i = 0; i < SETUP_DONE; i++)
+		if (setup_steps[i].response == type)
+			return i;
+	return -1;
+}
+
+/* Field by field: the padding of the structs is whatever the stack or the
+ * profile cache had there */
+static bool same_response(const struct wacom_v_response *a,
+			  const struct wacom_v_response *b)
+{
+	return a->type == b->type && a->model == b->model &&
+	       a->major_v == b->major_v && a->minor_v == b->minor_v &&
+	       a->max_x == b->max_x && a->max_y == b->max_y &&
+	       a->res_x == b->res_x && a->res_y == b->res_y;
+}
+
+static void handle_response(struct wacom *wacom, char *data, int len)
+{
+	struct wacom_v_response resp, *known = NULL;
+	int i;
+
+	if (wacom_v_parse_response(data, len, &resp)) {
+		dev_dbg(&wacom->dev->dev, "got a garbled response of length "
+			                  "%d: %s\n", len, data);
+		return;
+	}
+
+	i = profile_index(resp.type);
+	if (i >= 0)
+		known = &wacom->profile.responses[i];
+
+	/* The answers to wacom_confirm_profile() only confirm what we
+	 * know (see wacom_setup_from_profile()), the tablet can't change
+	 * under us. Anything else, like the configuration string read
+	 * back after a setting changed, is taken as it comes. */
+	if (known && known->type && wacom->setup_step == SETUP_DONE &&
+	    READ_ONCE(wacom->cmd_confirming)) {
+		if (!same_response(known, &resp)) {
+			dev_info(&wacom->serio->dev, "Tablet does not match "
+				 "its profile: %s\n", data);
+			WRITE_ONCE(wacom->profile_stale, true);
+		}
+	} else {
+		if (known) {
+			*known = resp;
+			strscpy(wacom->profile.text[i], data,
+				sizeof(wacom->profile.text[i]));
+			if (wacom->setup_step == SETUP_DONE)
+				WRITE_ONCE(wacom->profile_dirty, true);
+		}
+		apply_response(wacom, data, &resp);
+	}
+
+	/* Let the setup state machine or the command queue have a look */
+	if (wacom->setup_step < SETUP_DONE) {
+		WRITE_ONCE(wacom->setup_response, resp.type);
+		mod_delayed_work(system_wq, &wacom->setup_work, 0);
+	} else {
+		WRITE_ONCE(wacom->cmd_response, resp.type);
+		mod_delayed_work(system_wq, &wacom->cmd_work, 0);
+	}
+}
+
+static int hist_bucket(s64 us)
+{
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	return min(bucket, HIST_BUCKETS - 1);
+}
+
+static void hist_add(unsigned long *hist, s64 us)
+{
+	hist[hist_bucket(us)]++;
+}
+
+/* The tablet samples at a steady rate, but the time the header byte of
+ * a packet shows up in wacom_interrupt jitters with the serial port's
+ * FIFO and interrupt latency. Track the packet period and give each
+ * packet a time on that grid, pulled towards the arrival time by 1/8 of
+ * the difference. The result is never later than the arrival and never
+ * goes backwards. After a pause (tool out of range) start over. */
+static ktime_t packet_time(struct wacom_clock *clock, ktime_t arrival)
+{
+	ktime_t predicted = ktime_add_ns(clock->last, clock->period);
+	s64 err = ktime_to_ns(ktime_sub(arrival, predicted));
+	ktime_t time;
+
+	if (!clock->last || err > 4 * clock->period) {
+		clock->last = arrival;
+		return arrival;
+	}
+
+	clock->period += err >> 5;
+	clock->period = clamp(clock->period, clock->min_period,
+			      (s64)NSEC_PER_SEC / 10);
+
+	time = ktime_add_ns(predicted, err >> 3);
+	if (ktime_after(time, arrival))
+		time = arrival;
+	if (!ktime_after(time, clock->last))
+		time = ktime_add_ns(clock->last, clock->min_period);
+	if (ktime_after(time, arrival))
+		time = arrival;
+
+	clock->last = time;
+	return time;
+}
+
+static void wacom_clock_init(struct wacom_clock *clock, unsigned int baud)
+{
+	/* 10 bits per byte: start, 8 data, stop */
+	clock->min_period = (s64)(PACKET_LENGTH * 10 * USEC_PER_SEC /
+				  (baud ? baud : 9600)) * NSEC_PER_USEC;
+	clock->byte_time = (s64)(10 * USEC_PER_SEC /
+				 (baud ? baud : 9600)) * NSEC_PER_USEC;
+	clock->period = clock->min_period;
+	clock->last = 0;
+}
+
+static void count_packet(struct wacom_stats *stats, ktime_t time)
+{
+	if (stats->last_packet)
+		hist_add(stats->interval_hist,
+			 ktime_us_delta(time, stats->last_packet));
+	stats->last_packet = time;
+
+	if (time_after_eq(jiffies, stats->rate_start + HZ)) {
+		stats->rate = stats->rate_count * HZ /
+				(jiffies - stats->rate_start);
+		stats->rate_start = jiffies;
+		stats->rate_count = 0;
+	}
+	stats->rate_count++;
+}
+
+/*
+ * Pucks get a multitouch tool type of their own where the headers have
+ * one. Without it they go out as pens; the BTN_TOOL_* key still tells
+ * them apart.
+ */
+#ifdef MT_TOOL_MOUSE
+#define WACOM_MT_TOOL_MAX	max(MT_TOOL_PEN, MT_TOOL_MOUSE)
+#else
+#define MT_TOOL_MOUSE		MT_TOOL_PEN
+#define WACOM_MT_TOOL_MAX	MT_TOOL_PEN
+#endif
+
+/* With both channels on one input device, every channel also gets a
+ * multitouch slot of its own, so clients can follow both tools at once.
+ * This comes on top of the single touch events of both tools, which stay
+ * interleaved on that device: only split_channels separates them. */
+static void report_mt(struct input_dev *dev,
+		      const struct wacom_v_frame *frame, int channel)
+{
+	const struct wacom_v_event *ev;
+
+	input_mt_slot(dev, channel);
+	for (ev = frame->events; ev < frame->events + frame->nevents; ev++) {
+		switch (ev->type) {
+		case EV_KEY:
+			if (ev->code < BTN_TOOL_PEN || ev->code > BTN_TOOL_LENS)
+				break;
+			input_mt_report_slot_state(dev,
+				ev->code >= BTN_TOOL_MOUSE ? MT_TOOL_MOUSE :
+							     MT_TOOL_PEN,
+				ev->value);
+			break;
+		case EV_ABS:
+			if (ev->code == ABS_X)
+				input_event(dev, EV_ABS, ABS_MT_POSITION_X,
+					    ev->value);
+			else if (ev->code == ABS_Y)
+				input_event(dev, EV_ABS, ABS_MT_POSITION_Y,
+					    ev->value);
+			else if (ev->code == ABS_PRESSURE)
+				input_event(dev, EV_ABS, ABS_MT_PRESSURE,
+					    ev->value);
+			break;
+		}
+	}
+}
+
+/* time is what the frame is stamped with, arrival when the first byte of
+ * its (oldest) packet came in: the latency histogram counts from there. */
+static void emit_frame(struct wacom *wacom,
+		       const struct wacom_v_frame *frame, int channel,
+		       ktime_t time, ktime_t arrival)
+{
+	struct input_dev *dev = wacom->channel_dev[channel];
+	const struct wacom_v_event *ev;
+
+	input_set_timestamp(dev, time);
+	if (!wacom->split)
+		report_mt(dev, frame, channel);
+	for (ev = frame->events; ev < frame->events + frame->nevents; ev++)
+		input_event(dev, ev->type, ev->code, ev->value);
+	input_sync(dev);
+
+	wacom->last_sync = ktime_get();
+	atomic_long_inc(&wacom->stats.latency_hist[
+		hist_bucket(ktime_us_delta(wacom->last_sync, arrival))]);
+}
+
+/* Called with pending_lock held */
+static void flush_pending(struct wacom *wacom)
+{
+	if (!wacom->pending.nevents)
+		return;
+
+	emit_frame(wacom, &wacom->pending, wacom->pending_channel,
+		   wacom->pending_time, wacom->pending_arrival);
+	wacom->pending.nevents = 0;
+}
+
+/* Frames with key events (buttons, tools entering or leaving proximity)
+ * are never merged, or a click shorter than the window would vanish. */
+static bool frame_mergeable(const struct wacom_v_frame *frame)
+{
+	const struct wacom_v_event *ev;
+
+	for (ev = frame->events; ev < frame->events + frame->nevents; ev++)
+		if (ev->type == EV_KEY)
+			return false;
+	return true;
+}
+
+/* Merges frame into the pending one: newer absolute values replace
+ * older ones, relative ones add up. Returns false if it doesn't fit. */
+static bool merge_frame(struct wacom_v_frame *pending,
+			const struct wacom_v_frame *frame)
+{
+	const struct wacom_v_event *ev;
+	struct wacom_v_event *p;
+
+	for (ev = frame->events; ev < frame->events + frame->nevents; ev++) {
+		for (p = pending->events;
+		     p < pending->events + pending->nevents; p++)
+			if (p->type == ev->type && p->code == ev->code)
+				break;
+
+		if (p == pending->events + pending->nevents) {
+			if (pending->nevents == WACOM_V_MAX_EVENTS)
+				return false;
+			pending->nevents++;
+			*p = *ev;
+		} else if (ev->type == EV_REL) {
+			p->value += ev->value;
+		} else {
+			p->value = ev->value;
+		}
+	}
+	return true;
+}
+
+/* Reports at most one frame per coalesce_us: frames of the same channel
+ * that come in faster than that are merged and reported when the window
+ * is over. A frame of the other channel, or one with key events, first
+ * flushes what is pending and is reported right away. */
+static void coalesce_frame(struct wacom *wacom,
+			   const struct wacom_v_frame *frame, int channel,
+			   ktime_t time, ktime_t arrival, unsigned int window)
+{
+	struct wacom_v_frame *pending = &wacom->pending;
+	unsigned long flags;
+	ktime_t deadline;
+
+	spin_lock_irqsave(&wacom->pending_lock, flags);
+
+	if (pending->nevents && wacom->pending_channel != channel)
+		flush_pending(wacom);
+
+	if (!window || !frame_mergeable(frame)) {
+		flush_pending(wacom);
+		emit_frame(wacom, frame, channel, time, arrival);
+		goto out;
+	}
+
+	if (!pending->nevents) {
+		wacom->pending_channel = channel;
+		wacom->pending_arrival = arrival;
+	} else
+		wacom->stats.merged_frames++;
+	wacom->pending_time = time;
+
+	if (!merge_frame(pending, frame)) {
+		/* can't happen with the events we report, but be safe */
+		flush_pending(wacom);
+		emit_frame(wacom, frame, channel, time, arrival);
+		goto out;
+	}
+
+	deadline = ktime_add_us(wacom->last_sync, window);
+	if (!ktime_before(ktime_get(), deadline))
+		flush_pending(wacom);
+	else if (!hrtimer_active(&wacom->coalesce_timer))
+		hrtimer_start(&wacom->coalesce_timer, deadline,
+			      HRTIMER_MODE_ABS);
+out:
+	spin_unlock_irqrestore(&wacom->pending_lock, flags);
+}
+
+static enum hrtimer_restart wacom_coalesce_timer(struct hrtimer *timer)
+{
+	struct wacom *wacom = container_of(timer, struct wacom,
+					   coalesce_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&wacom->pending_lock, flags);
+	flush_pending(wacom);
+	spin_unlock_irqrestore(&wacom->pending_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/* time is when the packet was sampled, see packet_time(), arrival when
+ * its first byte came in */
+static void handle_packet(struct wacom *wacom, const unsigned char *data,
+			  ktime_t time, ktime_t arrival)
+{
+	struct wacom_v_frame *frame = &wacom->frame;
+	int channel = data[0] & 1;
+	unsigned int window;
+
+	/* Unknown packet types are only counted (see the unknown_packets
+	 * attribute): line noise can produce lots of them and we don't want
+	 * to flood the log from the interrupt handler. */
+	if (wacom_v_decode_packet(&wacom->decoder, data, frame)
+			!= WACOM_V_FRAME) {
+		trace_wacom_v_packet(data, &wacom->decoder.tool_state[channel],
+				     0, time);
+		return;
+	}
+
+	/* Until anything was held back, skip the lock */
+	window = READ_ONCE(wacom->coalesce_us);
+	if (!window && !READ_ONCE(wacom->pending.nevents))
+		emit_frame(wacom, frame, channel, time, arrival);
+	else
+		coalesce_frame(wacom, frame, channel, time, arrival, window);
+
+	trace_wacom_v_packet(data, &wacom->decoder.tool_state[channel],
+			     frame->nevents, time);
+}
+
+static void handle_record(struct wacom *wacom, struct wacom_rx_record *rec)
+{
+	if (rec->data[0] & 0x80) {
+		handle_packet(wacom, rec->data, rec->time, rec->arrival);
+	} else {
+		handle_response(wacom, rec->data, rec->len);
+	}
+}
+
+static void wacom_rx_work(struct work_struct *work)
+{
+	struct wacom *wacom = container_of(work, struct wacom, rx_work);
+	struct wacom_rx_record rec;
+
+	/* Drain everything that is there: one work item can handle a whole
+	 * burst of packets. */
+	while (kfifo_get(&wacom->rx_ring, &rec))
+		handle_record(wacom, &rec);
+}
+
+/* Called from the interrupt handler with a complete packet or response. */
+static void queue_record(struct wacom *wacom, const unsigned char *data,
+			 int len, ktime_t time, ktime_t arrival)
+{
+	struct wacom_rx_record rec;
+	unsigned int fill;
+
+	if (kfifo_is_full(&wacom->rx_ring)) {
+		wacom->rx_overflows++;
+		return;
+	}
+
+	rec.time = time;
+	rec.arrival = arrival;
+	rec.len = len;
+	memcpy(rec.data, data, len + 1); /* responses are NUL terminated */
+	kfifo_put(&wacom->rx_ring, rec);
+
+	fill = kfifo_len(&wacom->rx_ring);
+	if (fill > wacom->rx_high_water)
+		wacom->rx_high_water = fill;
+
+	queue_work(system_highpri_wq, &wacom->rx_work);
+}
+
+static int wacom_send(struct serio *serio, const char *command)
+{
+	int err = 0;
+	for (; !err && *command; command++)
+		err = serio_write(serio, *command);
+	return err;
+}
+
+/* Sends the queued commands one after the other. A command that expects
+ * a response (a "~" request) is only followed by the next one once the
+ * response is in or it timed out, so responses are matched to requests
+ * in order. Packets keep flowing all the while. Runs when something was
+ * queued, when handle_response got something and on timeouts. */
+static void wacom_cmd_work(struct work_struct *work)
+{
+	struct wacom *wacom = container_of(to_delayed_work(work),
+					   struct wacom, cmd_work);
+	s64 elapsed_ms;
+	int err;
+
+	/* The handshake has the line to itself, wacom_setup_finish()
+	 * schedules us again. */
+	if (wacom->setup_step != SETUP_DONE)
+		return;
+
+	if (READ_ONCE(wacom->profile_stale)) {
+		WRITE_ONCE(wacom->profile_stale, false);
+		profile_forget(wacom->serio->phys);
+		dev_info(&wacom->serio->dev, "Setting up the tablet again\n");
+		serio_rescan(wacom->serio);
+		return;
+	}
+
+	if (READ_ONCE(wacom->profile_dirty)) {
+		WRITE_ONCE(wacom->profile_dirty, false);
+		if (cache_profiles)
+			profile_store(wacom->serio->phys, &wacom->profile);
+	}
+
+	if (READ_ONCE(wacom->range_dirty)) {
+		mutex_lock(&wacom->config_lock);
+		update_position_range(wacom);
+		mutex_unlock(&wacom->config_lock);
+	}
+
+	if (wacom->cmd.response) {
+		elapsed_ms = ktime_ms_delta(ktime_get(), wacom->cmd_start);
+
+		if (READ_ONCE(wacom->cmd_response) != wacom->cmd.response) {
+			if (elapsed_ms < setup_timeout) {
+				schedule_delayed_work(&wacom->cmd_work,
+					msecs_to_jiffies(setup_timeout -
+							 elapsed_ms));
+				return;
+			}
+			wacom->stats.command_timeouts++;
+			dev_dbg(&wacom->serio->dev, "No response to %s\n",
+				wacom->cmd.text);
+		}
+		wacom->cmd.response = 0;
+		WRITE_ONCE(wacom->cmd_confirming, false);
+	}
+
+	while (kfifo_get(&wacom->cmd_queue, &wacom->cmd)) {
+		WRITE_ONCE(wacom->cmd_response, 0);
+		WRITE_ONCE(wacom->cmd_confirming, wacom->cmd.confirm);
+		wacom->cmd_start = ktime_get();
+		err = wacom_send(wacom->serio, wacom->cmd.text);
+		if (err) {
+			dev_err(&wacom->serio->dev, "Failed to send %s: %d\n",
+				wacom->cmd.text, err);
+			wacom->cmd.response = 0;
+			continue;
+		}
+		wacom->stats.commands++;
+
+		if (wacom->cmd.response) {
+			schedule_delayed_work(&wacom->cmd_work,
+					      msecs_to_jiffies(setup_timeout));
+			return;
+		}
+	}
+}
+
+/* Queues a command for the tablet, sent by wacom_cmd_work() as soon as
+ * the line is free. Called with cmd_lock held. */
+static int queue_command(struct wacom *wacom, const char *text,
+			 bool confirm)
+{
+	struct wacom_cmd cmd = { .confirm = confirm };
+
+	if (strscpy(cmd.text, text, sizeof(cmd.text)) < 0)
+		return -EINVAL;
+	if (text[0] == '~')
+		cmd.response = text[1];
+	if (!kfifo_put(&wacom->cmd_queue, cmd))
+		return -EBUSY;
+
+	mod_delayed_work(system_wq, &wacom->cmd_work, 0);
+	return 0;
+}
+
+static int wacom_queue_command(struct wacom *wacom, const char *text)
+{
+	return queue_command(wacom, text, false);
+}
+
+/* Changes a setting of the tablet itself. The configuration string is
+ * read back afterwards, see the configuration attribute. */
+static int wacom_set_tablet(struct wacom *wacom, int *setting, int val,
+			    const char *command)
+{
+	int err;
+
+	mutex_lock(&wacom->cmd_lock);
+	if (kfifo_avail(&wacom->cmd_queue) < 2) {
+		err = -EBUSY;
+		goto out;
+	}
+	err = wacom_queue_command(wacom, command);
+	if (!err)
+		err = wacom_queue_command(wacom,
+					  REQUEST_CONFIGURATION_STRING);
+	if (!err)
+		*setting = val;
+out:
+	mutex_unlock(&wacom->cmd_lock);
+	return err;
+}
+
+#define TABLET_ATTR(_name, _min, _max, _fmt)				\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));	\
+									\
+	return sprintf(buf, "%d\n", READ_ONCE(wacom->_name));		\
+}									\
+static ssize_t _name##_store(struct device *dev,			\
+			     struct device_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));	\
+	char command[sizeof(((struct wacom_cmd *)0)->text)];		\
+	int val, err;							\
+									\
+	err = kstrtoint(buf, 0, &val);					\
+	if (err)							\
+		return err;						\
+	if (val < (_min) || val > (_max))				\
+		return -EINVAL;						\
+	snprintf(command, sizeof(command), _fmt, val);			\
+	err = wacom_set_tablet(wacom, &wacom->_name, val, command);	\
+	return err ? err : count;					\
+}									\
+static DEVICE_ATTR_RW(_name)
+
+TABLET_ATTR(report_interval, 0, 255, COMMAND_INTERVAL_FMT);
+TABLET_ATTR(z_filter, 0, 1, COMMAND_Z_FILTER_FMT);
+TABLET_ATTR(multi_mode, 0, 1, COMMAND_MULTI_MODE_FMT);
+
+static ssize_t streaming_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%d\n", READ_ONCE(wacom->streaming));
+}
+
+static ssize_t streaming_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+	bool val;
+	int err;
+
+	err = kstrtobool(buf, &val);
+	if (err)
+		return err;
+	mutex_lock(&wacom->cmd_lock);
+	err = wacom_queue_command(wacom, val ? COMMAND_START_SENDING_PACKETS
+					     : COMMAND_STOP_SENDING_PACKETS);
+	if (!err)
+		wacom->streaming = val;
+	mutex_unlock(&wacom->cmd_lock);
+	return err ? err : count;
+}
+static DEVICE_ATTR_RW(streaming);
+
+static ssize_t configuration_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%s\n", wacom->configuration);
+}
+static DEVICE_ATTR_RO(configuration);
+
+static ssize_t unknown_packets_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%lu\n",
+		       wacom->decoder.packets[PACKET_UNKNOWN]);
+}
+static DEVICE_ATTR_RO(unknown_packets);
+
+static ssize_t rx_overflows_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%lu\n", wacom->rx_overflows);
+}
+static DEVICE_ATTR_RO(rx_overflows);
+
+static ssize_t rx_high_water_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%u\n", wacom->rx_high_water);
+}
+static DEVICE_ATTR_RO(rx_high_water);
+
+static ssize_t baud_show(struct device *dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct serio *serio = to_serio_port(dev);
+	unsigned int speed = 0;
+
+	if (serio->id.extra < ARRAY_SIZE(link_speeds))
+		speed = link_speeds[serio->id.extra];
+
+	return sprintf(buf, "%u\n", speed);
+}
+static DEVICE_ATTR_RO(baud);
+
+static ssize_t setup_state_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	switch (wacom->setup_step) {
+	case SETUP_DONE:
+		return sprintf(buf, wacom->profile_cached ? "cached\n"
+							  : "done\n");
+	case SETUP_FAILED:
+		return sprintf(buf, "failed\n");
+	default:
+		return sprintf(buf, "%s\n", setup_steps[wacom->setup_step].name);
+	}
+}
+static DEVICE_ATTR_RO(setup_state);
+
+static ssize_t setup_times_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < SETUP_DONE; i++)
+		len += sprintf(buf + len, "%s %lld\n", setup_steps[i].name,
+			       wacom->setup_us[i]);
+	len += sprintf(buf + len, "total %lld\n", wacom->setup_total_us);
+	return len;
+}
+static DEVICE_ATTR_RO(setup_times);
+
+static ssize_t thumbwheel_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%d\n", READ_ONCE(wacom->params.thumbwheel));
+}
+static DEVICE_ATTR_RO(thumbwheel);
+
+/* The decoder reads these without locking, so only ever store values it
+ * can cope with (no zero delays). */
+#define PARAM_ATTR(_name, _min, _max)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));	\
+									\
+	return sprintf(buf, "%d\n", READ_ONCE(wacom->params._name));	\
+}									\
+static ssize_t _name##_store(struct device *dev,			\
+			     struct device_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));	\
+	int val, err;							\
+									\
+	err = kstrtoint(buf, 0, &val);					\
+	if (err)							\
+		return err;						\
+	if (val < (_min) || val > (_max))				\
+		return -EINVAL;						\
+	mutex_lock(&wacom->config_lock);				\
+	WRITE_ONCE(wacom->params._name, val);				\
+	wacom_v_params_update(&wacom->params);				\
+	mutex_unlock(&wacom->config_lock);				\
+	return count;							\
+}									\
+static DEVICE_ATTR_RW(_name);
+
+WACOM_PARAMS(PARAM_ATTR)
+
+static ssize_t coalesce_us_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return sprintf(buf, "%u\n", READ_ONCE(wacom->coalesce_us));
+}
+
+static ssize_t coalesce_us_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+	unsigned int val;
+	int err;
+
+	err = kstrtouint(buf, 0, &val);
+	if (err)
+		return err;
+	if (val > USEC_PER_SEC)
+		return -EINVAL;
+	WRITE_ONCE(wacom->coalesce_us, val);
+	return count;
+}
+static DEVICE_ATTR_RW(coalesce_us);
+
+static ssize_t area_show(struct device *dev,
+			 struct device_attribute *attr, char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+	const struct wacom_v_area *area;
+	ssize_t len;
+
+	rcu_read_lock();
+	area = rcu_dereference(wacom->decoder.area);
+	if (area)
+		len = sprintf(buf, "%d %d %d %d %d %d %d\n",
+			      area->x0, area->y0, area->x1, area->y1,
+			      area->rotation, area->max_x, area->max_y);
+	else
+		len = sprintf(buf, "none\n");
+	rcu_read_unlock();
+	return len;
+}
+
+/* "x0 y0 x1 y1 rotation [max_x max_y]", or "none" */
+static ssize_t area_store(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+	struct wacom_area *new = NULL, *old = NULL;
+	struct wacom_v_area *area;
+	int n;
+
+	if (!sysfs_streq(buf, "none")) {
+		new = kzalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+		area = &new->area;
+		n = sscanf(buf, "%d %d %d %d %d %d %d", &area->x0, &area->y0,
+			   &area->x1, &area->y1, &area->rotation,
+			   &area->max_x, &area->max_y);
+		if ((n != 5 && n != 7) || wacom_v_area_update(area)) {
+			kfree(new);
+			return -EINVAL;
+		}
+	}
+
+	mutex_lock(&wacom->config_lock);
+	area = rcu_replace_pointer(wacom->decoder.area,
+				   new ? &new->area : NULL,
+				   lockdep_is_held(&wacom->config_lock));
+	update_position_range(wacom);
+	mutex_unlock(&wacom->config_lock);
+
+	if (area) {
+		old = container_of(area, struct wacom_area, area);
+		kfree_rcu(old, rcu);
+	}
+	return count;
+}
+static DEVICE_ATTR_RW(area);
+
+static struct attribute *wacom_attrs[] = {
+	&dev_attr_baud.attr,
+	&dev_attr_setup_state.attr,
+	&dev_attr_setup_times.attr,
+	&dev_attr_unknown_packets.attr,
+	&dev_attr_rx_overflows.attr,
+	&dev_attr_rx_high_water.attr,
+	&dev_attr_coalesce_us.attr,
+	&dev_attr_report_interval.attr,
+	&dev_attr_z_filter.attr,
+	&dev_attr_multi_mode.attr,
+	&dev_attr_streaming.attr,
+	&dev_attr_configuration.attr,
+	&dev_attr_area.attr,
+	&dev_attr_thumbwheel.attr,
+	&dev_attr_th_mode.attr,
+	&dev_attr_pos_delay.attr,
+	&dev_attr_neg_delay.attr,
+	&dev_attr_deadband.attr,
+	&dev_attr_thumbwheel_offset.attr,
+	&dev_attr_scroll_accel.attr,
+	&dev_attr_filter.attr,
+	&dev_attr_filter_alpha.attr,
+	&dev_attr_filter_beta.attr,
+	&dev_attr_predict.attr,
+	NULL
+};
+
+static const struct attribute_group wacom_attr_group = {
+	.attrs = wacom_attrs,
+};
+
+/* Counters of what the framer threw away, in the framer directory */
+#define FRAMER_DROP_ATTR(_name, _reason)				\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));	\
+									\
+	return sprintf(buf, "%lu\n", wacom->framer.drops[_reason]);	\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+FRAMER_DROP_ATTR(garbage_bytes, WACOM_V_DROP_GARBAGE);
+FRAMER_DROP_ATTR(truncated_packets, WACOM_V_DROP_TRUNCATED);
+FRAMER_DROP_ATTR(line_errors, WACOM_V_DROP_LINE_ERROR);
+FRAMER_DROP_ATTR(out_of_range_packets, WACOM_V_DROP_OUT_OF_RANGE);
+FRAMER_DROP_ATTR(bad_responses, WACOM_V_DROP_BAD_RESPONSE);
+
+static struct attribute *wacom_framer_attrs[] = {
+	&dev_attr_garbage_bytes.attr,
+	&dev_attr_truncated_packets.attr,
+	&dev_attr_line_errors.attr,
+	&dev_attr_out_of_range_packets.attr,
+	&dev_attr_bad_responses.attr,
+	NULL
+};
+
+static const struct attribute_group wacom_framer_attr_group = {
+	.name = "framer",
+	.attrs = wacom_framer_attrs,
+};
+
+#define STATS_ATTR(_name, _fmt, _value)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));	\
+									\
+	return sprintf(buf, _fmt "\n", _value);			\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+STATS_ATTR(bytes, "%lu", wacom->stats.bytes);
+STATS_ATTR(command_timeouts, "%lu", wacom->stats.command_timeouts);
+STATS_ATTR(commands, "%lu", wacom->stats.commands);
+STATS_ATTR(reconnects, "%lu", wacom->stats.reconnects);
+STATS_ATTR(merged_frames, "%lu", wacom->stats.merged_frames);
+STATS_ATTR(packets_device_id, "%lu",
+	   wacom->decoder.packets[PACKET_DEVICE_ID]);
+STATS_ATTR(packets_out_of_proximity, "%lu",
+	   wacom->decoder.packets[PACKET_OUT_OF_PROXIMITY]);
+STATS_ATTR(packets_stylus, "%lu",
+	   wacom->decoder.packets[PACKET_GENERAL_STYLUS]);
+STATS_ATTR(packets_first_cursor, "%lu",
+	   wacom->decoder.packets[PACKET_FIRST_CURSOR]);
+STATS_ATTR(packets_second_cursor, "%lu",
+	   wacom->decoder.packets[PACKET_SECOND_CURSOR]);
+STATS_ATTR(packets_unknown, "%lu",
+	   wacom->decoder.packets[PACKET_UNKNOWN]);
+/* Stale if nothing came in for a while */
+STATS_ATTR(packet_rate, "%lu",
+	   time_after(jiffies, wacom->stats.rate_start + 2 * HZ) ?
+			0 : wacom->stats.rate);
+
+static ssize_t show_hist(char *buf, const unsigned long *hist)
+{
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		len += sprintf(buf + len, "%lu%c", hist[i],
+			       i == HIST_BUCKETS - 1 ? '\n' : ' ');
+	return len;
+}
+
+static ssize_t interval_histogram_show(struct device *dev,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+
+	return show_hist(buf, wacom->stats.interval_hist);
+}
+static DEVICE_ATTR_RO(interval_histogram);
+
+static ssize_t latency_histogram_show(struct device *dev,
+				      struct device_attribute *attr,
+				      char *buf)
+{
+	struct wacom *wacom = serio_get_drvdata(to_serio_port(dev));
+	unsigned long hist[HIST_BUCKETS];
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		hist[i] = atomic_long_read(&wacom->stats.latency_hist[i]);
+	return show_hist(buf, hist);
+}
+static DEVICE_ATTR_RO(latency_histogram);
+
+static struct attribute *wacom_stats_attrs[] = {
+	&dev_attr_bytes.attr,
+	&dev_attr_command_timeouts.attr,
+	&dev_attr_commands.attr,
+	&dev_attr_reconnects.attr,
+	&dev_attr_merged_frames.attr,
+	&dev_attr_packets_device_id.attr,
+	&dev_attr_packets_out_of_proximity.attr,
+	&dev_attr_packets_stylus.attr,
+	&dev_attr_packets_first_cursor.attr,
+	&dev_attr_packets_second_cursor.attr,
+	&dev_attr_packets_unknown.attr,
+	&dev_attr_packet_rate.attr,
+	&dev_attr_interval_histogram.attr,
+	&dev_attr_latency_histogram.attr,
+	NULL
+};
+
+static const struct attribute_group wacom_stats_attr_group = {
+	.name = "stats",
+	.attrs = wacom_stats_attrs,
+};
+
+static ssize_t pressure_read(struct kobject *kobj, int tool, char *buf,
+			     loff_t off, size_t count)
+{
+	struct wacom *wacom =
+		serio_get_drvdata(to_serio_port(kobj_to_dev(kobj)));
+	const struct wacom_v_pressure_lut *lut;
+	size_t size = sizeof(*lut);
+
+	if (off >= size)
+		return 0;
+	count = min(count, size - (size_t)off);
+
+	rcu_read_lock();
+	lut = rcu_dereference(wacom->decoder.pressure[tool]);
+	memcpy(buf, (const char *)(lut ?: &linear_pressure) + off, count);
+	rcu_read_unlock();
+	return count;
+}
+
+/* Only takes whole tables, which replace the old one at once: a packet
+ * sees either of them, never a mix. A linear table removes the curve. */
+static ssize_t pressure_write(struct kobject *kobj, int tool, char *buf,
+			      loff_t off, size_t count)
+{
+	struct wacom *wacom =
+		serio_get_drvdata(to_serio_port(kobj_to_dev(kobj)));
+	struct wacom_pressure_curve *curve, *old;
+	struct wacom_v_pressure_lut *lut;
+	bool linear = true;
+	int i;
+
+	if (off || count != sizeof(*lut))
+		return -EINVAL;
+
+	curve = kmalloc(sizeof(*curve), GFP_KERNEL);
+	if (!curve)
+		return -ENOMEM;
+	memcpy(&curve->lut, buf, count);
+
+	/* No pressure has to stay no pressure, or the pen never lifts */
+	for (i = 0; i <= MAX_Z; i++) {
+		if (curve->lut.z[i] > MAX_Z || (!i && curve->lut.z[i])) {
+			kfree(curve);
+			return -EINVAL;
+		}
+		if (curve->lut.z[i] != i)
+			linear = false;
+	}
+
+	mutex_lock(&wacom->config_lock);
+	lut = rcu_replace_pointer(wacom->decoder.pressure[tool],
+				  linear ? NULL : &curve->lut,
+				  lockdep_is_held(&wacom->config_lock));
+	mutex_unlock(&wacom->config_lock);
+
+	if (linear)
+		kfree(curve);
+	if (lut) {
+		old = container_of(lut, struct wacom_pressure_curve, lut);
+		kfree_rcu(old, rcu);
+	}
+	return count;
+}
+
+/*
+ * Binary attributes are const since 6.13: BIN_ATTR_RW takes either kind
+ * of callback, but until 6.16 the const array goes in bin_attrs_new.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+#define wacom_bin_const
+#define wacom_bin_attrs		bin_attrs
+#elif LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define wacom_bin_const		const
+#define wacom_bin_attrs		bin_attrs_new
+#else
+#define wacom_bin_const		const
+#define wacom_bin_attrs		bin_attrs
+#endif
+
+#define PRESSURE_ATTR(_name, _tool)					\
+static ssize_t _name##_read(struct file *filp, struct kobject *kobj,	\
+			    wacom_bin_const struct bin_attribute *attr,	\
+			    char *buf, loff_t off, size_t count)	\
+{									\
+	return pressure_read(kobj, _tool, buf, off, count);		\
+}									\
+static ssize_t _name##_write(struct file *filp, struct kobject *kobj,	\
+			     wacom_bin_const struct bin_attribute *attr,\
+			     char *buf, loff_t off, size_t count)	\
+{									\
+	return pressure_write(kobj, _tool, buf, off, count);		\
+}									\
+static BIN_ATTR_RW(_name, sizeof(struct wacom_v_pressure_lut))
+
+PRESSURE_ATTR(pen, WACOM_V_PRESSURE_PEN);
+PRESSURE_ATTR(pencil, WACOM_V_PRESSURE_PENCIL);
+PRESSURE_ATTR(brush, WACOM_V_PRESSURE_BRUSH);
+PRESSURE_ATTR(airbrush, WACOM_V_PRESSURE_AIRBRUSH);
+PRESSURE_ATTR(rubber, WACOM_V_PRESSURE_RUBBER);
+
+static wacom_bin_const struct bin_attribute *wacom_bin_const
+wacom_pressure_attrs[] = {
+	&bin_attr_pen,
+	&bin_attr_pencil,
+	&bin_attr_brush,
+	&bin_attr_airbrush,
+	&bin_attr_rubber,
+	NULL
+};
+
+static const struct attribute_group wacom_pressure_attr_group = {
+	.name = "pressure",
+	.wacom_bin_attrs = wacom_pressure_attrs,
+};
+
+static const struct attribute_group *wacom_attr_groups[] = {
+	&wacom_attr_group,
+	&wacom_framer_attr_group,
+	&wacom_stats_attr_group,
+	&wacom_pressure_attr_group,
+	NULL
+};
+
+/* Copies the packet the framer just completed into the ring, unless the
+ * reader is too far behind. Called with serio->lock held. */
+static void ring_packet(struct wacom *wacom, struct wacom_ring *ring)
+{
+	const struct wacom_v_framer *fr = &wacom->framer;
+	struct wacom_v_ring_record *rec;
+	int i;
+
+	for (i = 0; i < WACOM_V_NUM_DROP_REASONS; i++) {
+		if (fr->drops[i] != ring->drops[i]) {
+			ring->drops[i] = fr->drops[i];
+			ring->flags |= 1 << i;
+		}
+	}
+
+	if (ring->head - smp_load_acquire(&ring->header->tail) >=
+	    RING_RECORDS) {
+		ring->flags |= WACOM_V_RING_LOST;
+		WRITE_ONCE(ring->header->lost, ++ring->lost);
+		return;
+	}
+
+	rec = &ring->records[ring->head & (RING_RECORDS - 1)];
+	rec->time = ktime_to_ns(wacom->rx_start);
+	memcpy(rec->data, fr->data, PACKET_LENGTH);
+	rec->channel = fr->data[0] & 1;
+	rec->flags = ring->flags;
+	ring->flags = 0;
+	smp_store_release(&ring->header->head, ++ring->head);
+
+	if (wq_has_sleeper(&ring->wait))
+		wake_up_interruptible(&ring->wait);
+}
+
+/* The framer has a whole packet or response, wacom->rx_start is when its
+ * first byte came in. */
+static void wacom_rx_done(struct wacom *wacom,
+			  enum wacom_v_framer_result result)
+{
+	struct wacom_v_framer *fr = &wacom->framer;
+	ktime_t time;
+
+	switch (result) {
+	case WACOM_V_PACKET:
+		if (static_branch_unlikely(&ring_active) && wacom->ring)
+			ring_packet(wacom, wacom->ring);
+		count_packet(&wacom->stats, wacom->rx_start);
+		time = packet_time(&wacom->clock, wacom->rx_start);
+		if (wacom->deferred)
+			queue_record(wacom, fr->data, PACKET_LENGTH, time,
+				     wacom->rx_start);
+		else
+			handle_packet(wacom, fr->data, time, wacom->rx_start);
+		break;
+	case WACOM_V_RESPONSE:
+		if (wacom->deferred)
+			queue_record(wacom, fr->data, fr->idx,
+				     wacom->rx_start, wacom->rx_start);
+		else
+			handle_response(wacom, fr->data, fr->idx);
+		break;
+	default:
+		break;
+	}
+}
+
+static irqreturn_t wacom_interrupt(struct serio *serio, unsigned char data,
+				   unsigned int flags)
+{
+	struct wacom *wacom = serio_get_drvdata(serio);
+	enum wacom_v_framer_result result;
+
+	if (wacom == NULL) {
+		printk(KERN_ERR DRIVER_NAME ": Something went VERY WRONG!\n");
+		return IRQ_HANDLED;
+	}
+	if (unlikely(wacom->rx_stopped))
+		return IRQ_HANDLED;
+
+	wacom->stats.bytes++;
+	if (data & 0x80)
+		wacom->rx_start = ktime_get();
+
+	result = wacom_v_framer_feed(&wacom->framer, data,
+				     flags & (SERIO_PARITY | SERIO_FRAME));
+	trace_wacom_v_rx(data, flags, result);
+
+	if (result != WACOM_V_NOTHING)
+		wacom_rx_done(wacom, result);
+	return IRQ_HANDLED;
+}
+
+static unsigned int tty_flag_to_serio(u8 flag)
+{
+	switch (flag) {
+	case TTY_FRAME:
+		return SERIO_FRAME;
+	case TTY_PARITY:
+		return SERIO_PARITY;
+	default:
+		return 0;
+	}
+}
+
+/* What wacom_interrupt() does, for a whole chunk of bytes from our line
+ * discipline (see wacom_ldisc_receive()) at once. The bytes of a chunk
+ * were all there by the time it is handed over, so the first byte of
+ * each packet is taken to have come in as long before the end of the
+ * chunk as the bytes after it take on the line. Called with serio->lock
+ * held, like wacom_interrupt(). */
+static void wacom_receive(struct wacom *wacom, const u8 *cp, const u8 *fp,
+			  size_t count)
+{
+	struct wacom_v_framer *fr = &wacom->framer;
+	enum wacom_v_framer_result result;
+	unsigned int flags = 0;
+	ktime_t now;
+	size_t i;
+
+	if (unlikely(wacom->rx_stopped))
+		return;
+
+	now = ktime_get();
+	wacom->stats.bytes += count;
+
+	for (i = 0; i < count; i++) {
+		if (cp[i] & 0x80)
+			wacom->rx_start = ktime_sub_ns(now, (count - 1 - i) *
+						       wacom->clock.byte_time);
+		if (fp)
+			flags = tty_flag_to_serio(fp[i]);
+
+		result = wacom_v_framer_feed(fr, cp[i], flags);
+		trace_wacom_v_rx(cp[i], flags, result);
+
+		if (result != WACOM_V_NOTHING)
+			wacom_rx_done(wacom, result);
+	}
+}
+
+/*
+ * Packet ring character device, see wacom_serial5_ring.h
+ *
+ * One reader at a time. Opening it allocates the ring and hooks it into
+ * the packet path, closing it (and unmapping it) unhooks and frees it.
+ */
+static int wacom_ring_open(struct inode *inode, struct file *file)
+{
+	/* misc_open() holds off misc_deregister() while we are here */
+	struct wacom *wacom = container_of(file->private_data, struct wacom,
+					   ring_misc);
+	struct wacom_ring *ring;
+	size_t size = PAGE_SIZE +
+		      RING_RECORDS * sizeof(struct wacom_v_ring_record);
+	int err = 0;
+
+	mutex_lock(&ring_lock);
+	if (wacom->ring) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring) {
+		err = -ENOMEM;
+		goto out;
+	}
+	ring->header = vmalloc_user(PAGE_ALIGN(size));
+	if (!ring->header) {
+		kfree(ring);
+		err = -ENOMEM;
+		goto out;
+	}
+	ring->records = (void *)ring->header + PAGE_SIZE;
+	ring->header->version = WACOM_V_RING_VERSION;
+	ring->header->nrecords = RING_RECORDS;
+	ring->header->record_size = sizeof(struct wacom_v_ring_record);
+	ring->header->data_offset = PAGE_SIZE;
+	init_waitqueue_head(&ring->wait);
+	ring->wacom = wacom;
+	file->private_data = ring;
+
+	static_branch_inc(&ring_active);
+	serio_pause_rx(wacom->serio);
+	memcpy(ring->drops, wacom->framer.drops, sizeof(ring->drops));
+	wacom->ring = ring;
+	serio_continue_rx(wacom->serio);
+out:
+	mutex_unlock(&ring_lock);
+	return err;
+}
+
+static int wacom_ring_release(struct inode *inode, struct file *file)
+{
+	struct wacom_ring *ring = file->private_data;
+	struct wacom *wacom;
+
+	mutex_lock(&ring_lock);
+	wacom = ring->wacom;
+	if (wacom) {
+		serio_pause_rx(wacom->serio);
+		wacom->ring = NULL;
+		serio_continue_rx(wacom->serio);
+	}
+	mutex_unlock(&ring_lock);
+	static_branch_dec(&ring_active);
+
+	vfree(ring->header);
+	kfree(ring);
+	return 0;
+}
+
+static int wacom_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct wacom_ring *ring = file->private_data;
+
+	return remap_vmalloc_range(vma, ring->header, vma->vm_pgoff);
+}
+
+static __poll_t wacom_ring_poll(struct file *file, poll_table *wait)
+{
+	struct wacom_ring *ring = file->private_data;
+
+	poll_wait(file, &ring->wait, wait);
+	if (!READ_ONCE(ring->wacom))
+		return EPOLLHUP;
+	if (smp_load_acquire(&ring->header->head) !=
+	    READ_ONCE(ring->header->tail))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations wacom_ring_fops = {
+	.owner		= THIS_MODULE,
+	.open		= wacom_ring_open,
+	.release	= wacom_ring_release,
+	.mmap		= wacom_ring_mmap,
+	.poll		= wacom_ring_poll,
+	.llseek		= noop_llseek,
+};
+
+/* The tablet is going away with the ring still open: the reader keeps the
+ * records it has, and poll() tells it there won't be any more. Called
+ * once nothing is received anymore. */
+static void wacom_ring_detach(struct wacom *wacom)
+{
+	mutex_lock(&ring_lock);
+	if (wacom->ring) {
+		WRITE_ONCE(wacom->ring->wacom, NULL);
+		wake_up_interruptible(&wacom->ring->wait);
+		wacom->ring = NULL;
+	}
+	mutex_unlock(&ring_lock);
+}
+
+static void wacom_disconnect(struct serio *serio)
+{
+	struct wacom *wacom = serio_get_drvdata(serio);
+	struct input_dev *input_dev;
+	struct wacom_v_area *area;
+	int i;
+
+	misc_deregister(&wacom->ring_misc);
+	sysfs_remove_groups(&serio->dev.kobj, wacom_attr_groups);
+	serio_close(serio);
+	wacom_ring_detach(wacom);
+	cancel_work_sync(&wacom->rx_work);
+	cancel_delayed_work_sync(&wacom->setup_work);
+	cancel_delayed_work_sync(&wacom->cmd_work);
+	hrtimer_cancel(&wacom->coalesce_timer);
+	serio_set_drvdata(serio, NULL);
+	for_each_input_dev(wacom, i, input_dev) {
+		if (i < wacom->registered)
+			input_unregister_device(input_dev);
+		else
+			input_free_device(input_dev);
+	}
+	/* Nobody decodes anymore */
+	area = rcu_dereference_protected(wacom->decoder.area, true);
+	if (area)
+		kfree(container_of(area, struct wacom_area, area));
+	for (i = 0; i < WACOM_V_PRESSURE_TOOLS; i++) {
+		struct wacom_v_pressure_lut *lut =
+			rcu_dereference_protected(wacom->decoder.pressure[i],
+						  true);
+
+		if (lut)
+			kfree(container_of(lut, struct wacom_pressure_curve,
+					   lut));
+	}
+	kfree(wacom);
+}
+
+static int send_setup_string(struct wacom *wacom, struct serio *serio)
+{
+	const char *s;
+	switch (wacom->dev->id.version) {
+	case MODEL_INTUOS:
+	case MODEL_INTUOS2:
+		s = COMMAND_MULTI_MODE_INPUT
+			COMMAND_ID
+			COMMAND_TRANSMIT_AT_MAX_RATE
+			COMMAND_START_SENDING_PACKETS;
+		break;
+	default:
+		/* TODO: remove this all together? All protocol5 tablets 
+		 * seem to use the string above.*/
+		s = COMMAND_MULTI_MODE_INPUT
+			COMMAND_ID
+			COMMAND_ORIGIN_IN_UPPER_LEFT
+			COMMAND_ENABLE_ALL_MACRO_BUTTONS
+			COMMAND_DISABLE_GROUP_1_MACRO_BUTTONS
+			COMMAND_TRANSMIT_AT_MAX_RATE
+			COMMAND_DISABLE_INCREMENTAL_MODE
+			COMMAND_ENABLE_CONTINUOUS_MODE
+			COMMAND_Z_FILTER
+			COMMAND_START_SENDING_PACKETS;
+		break;
+	}
+	return wacom_send(serio, s);
+}
+
+/* Gives up on the tablet. The driver stays bound to the port, without
+ * input devices, and setup_state shows "failed" until the port is probed
+ * again: that is up to the user, a tablet that isn't there would only
+ * fail over and over. */
+static void wacom_setup_failed(struct wacom *wacom)
+{
+	wacom->setup_step = SETUP_FAILED;
+	dev_err(&wacom->serio->dev, "Giving up on the tablet, write "
+		"\"rescan\" to drvctl to try again\n");
+}
+
+static void wacom_setup_finish(struct wacom *wacom)
+{
+	struct input_dev *input_dev;
+	int err, i;
+
+	mutex_lock(&wacom->config_lock);
+	update_position_range(wacom);
+	mutex_unlock(&wacom->config_lock);
+
+	err = send_setup_string(wacom, wacom->serio);
+	for_each_input_dev(wacom, i, input_dev) {
+		if (!err)
+			err = input_register_device(input_dev);
+		if (!err)
+			wacom->registered++;
+	}
+	if (err) {
+		dev_err(&wacom->serio->dev, "Failed to set up tablet: %d\n",
+			err);
+		wacom_setup_failed(wacom);
+		return;
+	}
+
+	wacom->setup_total_us = ktime_us_delta(ktime_get(),
+					       wacom->setup_start);
+	if (cache_profiles)
+		profile_store(wacom->serio->phys, &wacom->profile);
+
+	/* Send whatever was queued in the meantime */
+	schedule_delayed_work(&wacom->cmd_work, 0);
+}
+
+/* What we know about the tablet can't be trusted anymore: have
+ * wacom_cmd_work() probe the port from scratch. */
+static void wacom_profile_stale(struct wacom *wacom)
+{
+	WRITE_ONCE(wacom->profile_stale, true);
+	mod_delayed_work(system_wq, &wacom->cmd_work, 0);
+}
+
+/* Asks the tablet the setup questions again, handle_response() compares
+ * the answers with the profile. If they can't be asked, the profile is
+ * as good as wrong. */
+static void wacom_confirm_profile(struct wacom *wacom)
+{
+	int i, err = 0;
+
+	mutex_lock(&wacom->cmd_lock);
+	for (i = 0; i < SETUP_DONE && !err; i++)
+		err = queue_command(wacom, setup_steps[i].request, true);
+	mutex_unlock(&wacom->cmd_lock);
+
+	if (err) {
+		dev_warn(&wacom->serio->dev,
+			 "Could not confirm the profile: %d\n", err);
+		wacom_profile_stale(wacom);
+	}
+}
+
+/* Brings the tablet up at once with the profile it had the last time it
+ * was on this port, then asks it the setup questions again in the
+ * background. If the answers differ (another tablet was plugged in),
+ * handle_response() notices and wacom_cmd_work() has the port probed
+ * from scratch. */
+static void wacom_setup_from_profile(struct wacom *wacom)
+{
+	const struct wacom_v_response *resp;
+	int i;
+
+	dev_dbg(&wacom->serio->dev, "Using the profile of %s\n",
+		wacom->serio->phys);
+	for (i = 0; i < SETUP_DONE; i++) {
+		resp = &wacom->profile.responses[i];
+		if (resp->type)
+			apply_response(wacom, wacom->profile.text[i], resp);
+	}
+
+	wacom->profile_cached = true;
+	wacom->setup_step = SETUP_DONE;
+	wacom_setup_finish(wacom);
+	if (wacom->setup_step != SETUP_DONE)
+		return;
+
+	wacom_confirm_profile(wacom);
+}
+
+/* Drives the handshake with the tablet. Runs when a request times out and
+ * when handle_response got something, so the probe itself doesn't have to
+ * wait for the (slow) tablet. */
+static void wacom_setup_work(struct work_struct *work)
+{
+	struct wacom *wacom = container_of(to_delayed_work(work),
+					   struct wacom, setup_work);
+	enum setup_step step = wacom->setup_step;
+	s64 elapsed_ms;
+	int err;
+
+	if (step >= SETUP_DONE)
+		return;
+
+	if (step == SETUP_MODEL && !wacom->setup_tries && cache_profiles &&
+	    profile_lookup(wacom->serio->phys, &wacom->profile)) {
+		wacom_setup_from_profile(wacom);
+		return;
+	}
+
+	if (wacom->setup_tries) {
+		elapsed_ms = ktime_ms_delta(ktime_get(), wacom->step_start);
+
+		if (READ_ONCE(wacom->setup_response) ==
+		    setup_steps[step].response) {
+			wacom->setup_us[step] = ktime_us_delta(ktime_get(),
+							wacom->step_start);
+			step++;
+		} else if (elapsed_ms < setup_timeout) {
+			/* Some other response, keep waiting */
+			schedule_delayed_work(&wacom->setup_work,
+				msecs_to_jiffies(setup_timeout - elapsed_ms));
+			return;
+		} else {
+			wacom->stats.command_timeouts++;
+			if (wacom->setup_tries > setup_retries) {
+				dev_info(&wacom->serio->dev, "Timed out "
+					 "waiting for tablet to respond "
+					 "with %s.\n",
+					 setup_steps[step].name);
+				if (setup_steps[step].required) {
+					wacom_setup_failed(wacom);
+					return;
+				}
+				step++;
+			}
+			/* else: retry this step */
+		}
+
+		if (step != wacom->setup_step) {
+			wacom->setup_step = step;
+			wacom->setup_tries = 0;
+		}
+	}
+
+	if (step == SETUP_DONE) {
+		wacom_setup_finish(wacom);
+		return;
+	}
+
+	/* Note that setting the link speed is the job of inputattach,
+	 * which also checks that the tablet answers at the negotiated
+	 * speed (see the baud attribute). We assume that reset
+	 * negotiation has already happened, here. */
+	err = 0;
+	if (step == SETUP_MODEL)
+		err = wacom_send(wacom->serio, COMMAND_STOP_SENDING_PACKETS);
+
+	WRITE_ONCE(wacom->setup_response, 0);
+	wacom->step_start = ktime_get();
+	wacom->setup_tries++;
+	if (!err)
+		err = wacom_send(wacom->serio, setup_steps[step].request);
+	if (err) {
+		dev_err(&wacom->serio->dev, "Failed to send %s request: %d\n",
+			setup_steps[step].name, err);
+		wacom_setup_failed(wacom);
+		return;
+	}
+
+	schedule_delayed_work(&wacom->setup_work,
+			      msecs_to_jiffies(setup_timeout));
+}
+
+/* Stops looking at the line and lifts whatever tools were on the tablet,
+ * so nothing is left pressed while the line is gone. The input devices
+ * stay. Undone by wacom_start(). */
+static void wacom_stop(struct wacom *wacom)
+{
+	struct serio *serio = wacom->serio;
+	struct wacom_v_frame *frame = &wacom->frame;
+	unsigned long flags;
+	ktime_t now;
+	int channel;
+
+	serio_pause_rx(serio);
+	wacom->rx_stopped = true;
+	serio_continue_rx(serio);
+
+	/* Whatever a command waited for is not going to come */
+	cancel_delayed_work_sync(&wacom->cmd_work);
+	wacom->cmd.response = 0;
+	cancel_work_sync(&wacom->rx_work);
+	kfifo_reset(&wacom->rx_ring);
+	hrtimer_cancel(&wacom->coalesce_timer);
+
+	spin_lock_irqsave(&wacom->pending_lock, flags);
+	flush_pending(wacom);
+	spin_unlock_irqrestore(&wacom->pending_lock, flags);
+
+	for (channel = 0; channel < 2; channel++)
+		if (wacom_v_decoder_release(&wacom->decoder, channel, frame) ==
+		    WACOM_V_FRAME) {
+			now = ktime_get();
+			emit_frame(wacom, frame, channel, now, now);
+		}
+
+	wacom_v_framer_reset(&wacom->framer);
+	wacom->clock.last = 0;
+}
+
+static void wacom_start(struct wacom *wacom)
+{
+	serio_pause_rx(wacom->serio);
+	wacom->rx_stopped = false;
+	serio_continue_rx(wacom->serio);
+}
+
+/* Sends the tablet settings changed through the attributes again, after
+ * send_setup_string() went back to the defaults. */
+static void wacom_restore_settings(struct wacom *wacom)
+{
+	char command[sizeof(wacom->cmd.text)];
+	int err = 0;
+
+	mutex_lock(&wacom->cmd_lock);
+	if (wacom->report_interval) {
+		snprintf(command, sizeof(command), COMMAND_INTERVAL_FMT,
+			 wacom->report_interval);
+		err = wacom_queue_command(wacom, command);
+	}
+	if (!err && wacom->z_filter >= 0) {
+		snprintf(command, sizeof(command), COMMAND_Z_FILTER_FMT,
+			 wacom->z_filter);
+		err = wacom_queue_command(wacom, command);
+	}
+	if (!err && !wacom->multi_mode)
+		err = wacom_queue_command(wacom, COMMAND_SINGLE_MODE_INPUT);
+	if (!err && !wacom->streaming)
+		err = wacom_queue_command(wacom,
+					  COMMAND_STOP_SENDING_PACKETS);
+	mutex_unlock(&wacom->cmd_lock);
+
+	/* The attributes would show settings the tablet doesn't have, set
+	 * it up from scratch (with the defaults) instead */
+	if (err) {
+		dev_warn(&wacom->serio->dev,
+			 "Could not restore the tablet settings: %d\n", err);
+		wacom_profile_stale(wacom);
+	}
+}
+
+/* The serial port was reset or resumed. Keep the input devices (and
+ * everyone who has them open), set the tablet up again and have it
+ * confirm it is still the same one. Before the tablet was set up there
+ * is nothing worth keeping, so fail and let serio do a full connect. */
+static int wacom_reconnect(struct serio *serio)
+{
+	struct wacom *wacom = serio_get_drvdata(serio);
+	int err;
+
+	if (!wacom || wacom->setup_step != SETUP_DONE)
+		return -EINVAL;
+
+	wacom_stop(wacom);
+	wacom_start(wacom);
+	wacom->stats.reconnects++;
+
+	err = send_setup_string(wacom, serio);
+	if (err) {
+		dev_err(&serio->dev, "Failed to set up tablet again: %d\n",
+			err);
+		return err;
+	}
+
+	wacom_restore_settings(wacom);
+	wacom_confirm_profile(wacom);
+	return 0;
+}
+
+/* Suspend or shutdown: have the tablet stop talking to us */
+static void wacom_cleanup(struct serio *serio)
+{
+	struct wacom *wacom = serio_get_drvdata(serio);
+
+	if (!wacom || wacom->setup_step != SETUP_DONE)
+		return;
+
+	wacom_stop(wacom);
+	wacom_send(serio, COMMAND_STOP_SENDING_PACKETS);
+}
+
+static int wacom_init_input_dev(struct wacom *wacom,
+				struct input_dev *input_dev, int channel)
+{
+	struct serio *serio = wacom->serio;
+
+	input_dev->name = channel ? DEVICE_NAME " (second tool)"
+				  : DEVICE_NAME;
+	input_dev->id.bustype = BUS_RS232;
+#if 0
+	input_dev->id.vendor  = SERIO_WACOM_V;
+	input_dev->id.product = serio->id.extra;
+#else
+	input_dev->id.vendor  = USB_VENDOR_ID_WACOM;
+	input_dev->id.product = 0x24;
+#endif
+	input_dev->id.version = 0x0100;
+	input_dev->dev.parent = &serio->dev;
+
+	input_dev->evbit[0] = BIT_MASK(EV_KEY)
+			    | BIT_MASK(EV_ABS)
+			    | BIT_MASK(EV_REL);
+
+	input_set_capability(input_dev, EV_REL, REL_WHEEL);
+	input_set_capability(input_dev, EV_REL, REL_WHEEL_HI_RES);
+	input_set_capability(input_dev, EV_MSC, MSC_SERIAL);
+
+	/* Limits and resolution follow once the tablet told them, see
+	 * update_position_range() */
+	input_set_abs_params(input_dev, ABS_X, 0, 0, 0, 0);
+	input_set_abs_params(input_dev, ABS_Y, 0, 0, 0, 0);
+
+	/* For 4D mouse */
+	input_set_abs_params(input_dev, ABS_THROTTLE, -1023, 1023, 0, 0);
+	input_set_abs_params(input_dev, ABS_RZ, -899, 899, 0, 0);
+
+	/* For airbrush */
+	input_set_abs_params(input_dev, ABS_WHEEL, 0, 1023, 0, 0);
+
+	__set_bit(BTN_LEFT,		input_dev->keybit);
+	__set_bit(BTN_MIDDLE,		input_dev->keybit);
+	__set_bit(BTN_RIGHT,		input_dev->keybit);
+	__set_bit(BTN_SIDE,		input_dev->keybit);
+	__set_bit(BTN_EXTRA,		input_dev->keybit);
+	__set_bit(BTN_FORWARD,		input_dev->keybit);
+	__set_bit(BTN_BACK,		input_dev->keybit);
+	__set_bit(BTN_TASK,		input_dev->keybit);
+	__set_bit(BTN_STYLUS,		input_dev->keybit);
+	__set_bit(BTN_STYLUS2,		input_dev->keybit);
+	__set_bit(BTN_TOOL_AIRBRUSH,	input_dev->keybit);
+	__set_bit(BTN_TOOL_BRUSH,	input_dev->keybit);
+	__set_bit(BTN_TOOL_LENS,	input_dev->keybit);
+	__set_bit(BTN_TOOL_MOUSE,	input_dev->keybit);
+	__set_bit(BTN_TOOL_PEN,		input_dev->keybit);
+	__set_bit(BTN_TOOL_PENCIL,	input_dev->keybit);
+	__set_bit(BTN_TOOL_RUBBER,	input_dev->keybit);
+
+	__set_bit(ABS_MISC,		input_dev->absbit);
+
+	if (wacom->split)
+		return 0;
+
+	/* One slot per channel, see report_mt() */
+	input_set_abs_params(input_dev, ABS_MT_POSITION_X, 0, 0, 0, 0);
+	input_set_abs_params(input_dev, ABS_MT_POSITION_Y, 0, 0, 0, 0);
+	input_set_abs_params(input_dev, ABS_MT_PRESSURE, 0, MAX_Z, 0, 0);
+	input_set_abs_params(input_dev, ABS_MT_TOOL_TYPE,
+			     MT_TOOL_PEN, WACOM_MT_TOOL_MAX, 0, 0);
+	return input_mt_init_slots(input_dev, 2, 0);
+}
+
+static int wacom_connect(struct serio *serio, struct serio_driver *drv)
+{
+	struct wacom *wacom;
+	struct input_dev *input_dev, *input_dev2 = NULL;
+	int err = -ENOMEM, i;
+
+	wacom = kzalloc(sizeof(struct wacom), GFP_KERNEL);
+	input_dev = input_allocate_device();
+	if (split_channels)
+		input_dev2 = input_allocate_device();
+	if (!wacom || !input_dev || (split_channels && !input_dev2))
+		goto fail0;
+
+	wacom->dev = input_dev;
+	wacom->split = split_channels;
+	wacom->channel_dev[0] = input_dev;
+	wacom->channel_dev[1] = split_channels ? input_dev2 : input_dev;
+	wacom->serio = serio;
+	wacom_v_framer_init(&wacom->framer);
+	wacom->params = params;
+	wacom->params.thumbwheel = 0;
+	wacom_params_clamp(&wacom->params);
+	wacom_v_decoder_init(&wacom->decoder, &wacom->params);
+	wacom->decoder.separate_devices = wacom->split;
+	wacom->deferred = deferred;
+	INIT_KFIFO(wacom->rx_ring);
+	INIT_WORK(&wacom->rx_work, wacom_rx_work);
+	INIT_DELAYED_WORK(&wacom->setup_work, wacom_setup_work);
+	mutex_init(&wacom->cmd_lock);
+	mutex_init(&wacom->config_lock);
+	/* All intuos and intuos2 tablets have the same resolution. */
+	wacom->res_x = 2540;
+	wacom->res_y = 2540;
+	INIT_KFIFO(wacom->cmd_queue);
+	INIT_DELAYED_WORK(&wacom->cmd_work, wacom_cmd_work);
+	/* What send_setup_string() sets up */
+	wacom->report_interval = 0;
+	wacom->z_filter = -1;
+	wacom->multi_mode = 1;
+	wacom->streaming = 1;
+	wacom_clock_init(&wacom->clock,
+			 serio->id.extra < ARRAY_SIZE(link_speeds) ?
+				link_speeds[serio->id.extra] : 0);
+	wacom->coalesce_us = coalesce_us;
+	spin_lock_init(&wacom->pending_lock);
+	hrtimer_setup(&wacom->coalesce_timer, wacom_coalesce_timer,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+
+	for (i = 0; i < (wacom->split ? 2 : 1); i++) {
+		err = wacom_init_input_dev(wacom, wacom->channel_dev[i], i);
+		if (err)
+			goto fail0;
+	}
+
+	serio_set_drvdata(serio, wacom);
+
+	err = serio_open(serio, drv);
+	if (err)
+		goto fail1;
+
+	err = sysfs_create_groups(&serio->dev.kobj, wacom_attr_groups);
+	if (err)
+		goto fail2;
+
+	snprintf(wacom->ring_name, sizeof(wacom->ring_name), "wacom_v_%s",
+		 dev_name(&serio->dev));
+	wacom->ring_misc.minor = MISC_DYNAMIC_MINOR;
+	wacom->ring_misc.name = wacom->ring_name;
+	wacom->ring_misc.fops = &wacom_ring_fops;
+	wacom->ring_misc.parent = &serio->dev;
+	err = misc_register(&wacom->ring_misc);
+	if (err)
+		goto fail3;
+
+	/* The input device is registered once the tablet told us what it
+	 * is, see wacom_setup_work. */
+	wacom->setup_start = ktime_get();
+	schedule_delayed_work(&wacom->setup_work, 0);
+
+	return 0;
+
+ fail3:	sysfs_remove_groups(&serio->dev.kobj, wacom_attr_groups);
+ fail2:	serio_close(serio);
+	cancel_work_sync(&wacom->rx_work);
+	cancel_delayed_work_sync(&wacom->setup_work);
+	cancel_delayed_work_sync(&wacom->cmd_work);
+	hrtimer_cancel(&wacom->coalesce_timer);
+ fail1:	serio_set_drvdata(serio, NULL);
+ fail0:	input_free_device(input_dev);
+	input_free_device(input_dev2);
+	kfree(wacom);
+	return err;
+}
+
+static struct serio_device_id wacom_serio_ids[] = {
+	{
+		.type	= SERIO_RS232,
+		.proto	= SERIO_WACOM_V,
+		.id	= SERIO_ANY,
+		.extra	= SERIO_ANY,
+	},
+	{ 0 }
+};
+
+MODULE_DEVICE_TABLE(serio, wacom_serio_ids);
+
+static struct serio_driver wacom_drv = {
+	.driver		= {
+		.name 	= DRIVER_NAME,
+	},
+	.description	= DRIVER_DESC,
+	.id_table	= wacom_serio_ids,
+	.interrupt	= wacom_interrupt,
+	.connect	= wacom_connect,
+	.disconnect	= wacom_disconnect,
+	.reconnect	= wacom_reconnect,
+	.fast_reconnect	= wacom_reconnect,
+	.cleanup	= wacom_cleanup,
+};
+
+/*
+ * Line discipline front end
+ *
+ * serport (N_MOUSE) hands every byte from the tty to the driver with
+ * serio_interrupt(): an indirect call, a drvdata lookup and a lock per
+ * byte. With the ldisc module parameter set, the driver registers a line
+ * discipline of its own under that number. It is attached just like
+ * serport (TIOCSETD, SPIOCSTYPE, then a read() that only returns when
+ * the tty goes away) and registers a serio port the same way, so the
+ * driver binds to it as usual. But while the driver is bound, every chunk
+ * from the tty goes straight to wacom_receive() under a single lock.
+ */
+enum {
+	WACOM_PORT_BUSY,	/* read() registered the serio port */
+	WACOM_PORT_ACTIVE,	/* the serio port is open */
+	WACOM_PORT_DEAD,	/* hung up, read() should return */
+};
+
+struct wacom_port {
+	struct tty_struct *tty;
+	struct serio *serio;
+	struct serio_device_id id;	/* set with SPIOCSTYPE */
+	spinlock_t lock;		/* against the serio port's open/close */
+	unsigned long flags;
+	wait_queue_head_t wait;
+};
+
+static int wacom_port_write(struct serio *serio, unsigned char data)
+{
+	struct wacom_port *port = serio->port_data;
+
+	return port->tty->ops->write(port->tty, &data, 1) == 1 ? 0 : -EIO;
+}
+
+static int wacom_port_open(struct serio *serio)
+{
+	struct wacom_port *port = serio->port_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&port->lock, flags);
+	set_bit(WACOM_PORT_ACTIVE, &port->flags);
+	spin_unlock_irqrestore(&port->lock, flags);
+	return 0;
+}
+
+static void wacom_port_close(struct serio *serio)
+{
+	struct wacom_port *port = serio->port_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&port->lock, flags);
+	clear_bit(WACOM_PORT_ACTIVE, &port->flags);
+	spin_unlock_irqrestore(&port->lock, flags);
+}
+
+static int wacom_ldisc_open(struct tty_struct *tty)
+{
+	struct wacom_port *port;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	port = kzalloc(sizeof(*port), GFP_KERNEL);
+	if (!port)
+		return -ENOMEM;
+
+	port->tty = tty;
+	spin_lock_init(&port->lock);
+	init_waitqueue_head(&port->wait);
+
+	tty->disc_data = port;
+	tty->receive_room = 256;
+	return 0;
+}
+
+static void wacom_ldisc_close(struct tty_struct *tty)
+{
+	kfree(tty->disc_data);
+}
+
+static void wacom_ldisc_receive(struct tty_struct *tty, const u8 *cp,
+				const u8 *fp, size_t count)
+{
+	struct wacom_port *port = tty->disc_data;
+	struct serio *serio = port->serio;
+	struct wacom *wacom;
+	unsigned long flags;
+	size_t i;
+
+	spin_lock_irqsave(&port->lock, flags);
+	if (!test_bit(WACOM_PORT_ACTIVE, &port->flags))
+		goto out;
+
+	/* serio->lock is what serio_interrupt() holds around the driver's
+	 * interrupt callback, and what serio_pause_rx() waits for. */
+	spin_lock(&serio->lock);
+	wacom = serio_get_drvdata(serio);
+	if (serio->drv == &wacom_drv && wacom) {
+		wacom_receive(wacom, cp, fp, count);
+		spin_unlock(&serio->lock);
+		goto out;
+	}
+	spin_unlock(&serio->lock);
+
+	/* Some other driver is bound to the port, do what serport does */
+	for (i = 0; i < count; i++)
+		serio_interrupt(serio, cp[i], fp ? tty_flag_to_serio(fp[i]) : 0);
+out:
+	spin_unlock_irqrestore(&port->lock, flags);
+}
+
+/* Registers the serio port and waits until the tty is hung up or the
+ * line discipline changed, like serport does. */
+static ssize_t wacom_ldisc_read(struct tty_struct *tty, struct file *file,
+				u8 *kbuf, size_t nr, void **cookie,
+				unsigned long offset)
+{
+	struct wacom_port *port = tty->disc_data;
+	struct serio *serio;
+
+	if (test_and_set_bit(WACOM_PORT_BUSY, &port->flags))
+		return -EBUSY;
+
+	serio = kzalloc(sizeof(*serio), GFP_KERNEL);
+	if (!serio) {
+		clear_bit(WACOM_PORT_BUSY, &port->flags);
+		return -ENOMEM;
+	}
+
+	strscpy(serio->name, DEVICE_NAME, sizeof(serio->name));
+	snprintf(serio->phys, sizeof(serio->phys), "%s/serio0",
+		 tty_name(tty));
+	serio->id = port->id;
+	serio->id.type = SERIO_RS232;
+	serio->write = wacom_port_write;
+	serio->open = wacom_port_open;
+	serio->close = wacom_port_close;
+	serio->port_data = port;
+	serio->dev.parent = tty->dev;
+	port->serio = serio;
+
+	serio_register_port(serio);
+	dev_info(tty->dev, "%s attached to %s\n", DRIVER_NAME,
+		 tty_name(tty));
+
+	wait_event_interruptible(port->wait,
+				 test_bit(WACOM_PORT_DEAD, &port->flags));
+	serio_unregister_port(serio);
+	port->serio = NULL;
+
+	clear_bit(WACOM_PORT_DEAD, &port->flags);
+	clear_bit(WACOM_PORT_BUSY, &port->flags);
+	return 0;
+}
+
+static int wacom_ldisc_ioctl(struct tty_struct *tty, unsigned int cmd,
+			     unsigned long arg)
+{
+	struct wacom_port *port = tty->disc_data;
+	unsigned long type;
+
+	if (cmd != SPIOCSTYPE)
+		return -EINVAL;
+
+	if (get_user(type, (unsigned long __user *)arg))
+		return -EFAULT;
+
+	port->id.proto = type & 0x000000ff;
+	port->id.id    = (type & 0x0000ff00) >> 8;
+	port->id.extra = (type & 0x00ff0000) >> 16;
+	return 0;
+}
+
+static void wacom_ldisc_hangup(struct tty_struct *tty)
+{
+	struct wacom_port *port = tty->disc_data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&port->lock, flags);
+	set_bit(WACOM_PORT_DEAD, &port->flags);
+	spin_unlock_irqrestore(&port->lock, flags);
+
+	wake_up_interruptible(&port->wait);
+}
+
+static struct tty_ldisc_ops wacom_ldisc_ops = {
+	.owner		= THIS_MODULE,
+	.name		= DRIVER_NAME,
+	.open		= wacom_ldisc_open,
+	.close		= wacom_ldisc_close,
+	.read		= wacom_ldisc_read,
+	.ioctl		= wacom_ldisc_ioctl,
+	.receive_buf	= wacom_ldisc_receive,
+	.hangup		= wacom_ldisc_hangup,
+};
+
+static int __init wacom_init(void)
+{
+	int err, i;
+
+	BUILD_BUG_ON(sizeof(((struct wacom_v_ring_record *)0)->data) !=
+		     PACKET_LENGTH);
+
+	for (i = 0; i <= MAX_Z; i++)
+		linear_pressure.z[i] = i;
+	wacom_params_clamp(&params);
+
+	err = serio_register_driver(&wacom_drv);
+	if (err || !ldisc)
+		return err;
+
+	wacom_ldisc_ops.num = ldisc;
+	err = tty_register_ldisc(&wacom_ldisc_ops);
+	if (err)
+		serio_unregister_driver(&wacom_drv);
+	return err;
+}
+
+static void __exit wacom_exit(void)
+{
+	struct wacom_profile_entry *entry, *next;
+
+	if (ldisc)
+		tty_unregister_ldisc(&wacom_ldisc_ops);
+	serio_unregister_driver(&wacom_drv);
+	list_for_each_entry_safe(entry, next, &profile_cache, list)
+		kfree(entry);
+}
+
+module_init(wacom_init);
+module_exit(wacom_exit);
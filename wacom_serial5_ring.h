@@ -0,0 +1,54 @@
+/*
+ * Wacom protocol 5 packet ring
+ *
+ * Layout of the ring of raw packets the driver exposes through a
+ * character device per tablet (/dev/wacom_v_<serio port>), for
+ * diagnostics and for recording what the tablet sends. The device is
+ * mmap()ed: the first page holds a struct wacom_v_ring_header, the
+ * records follow at data_offset.
+ *
+ * The driver is the only writer of records and of head, the reader the
+ * only writer of tail. Record n (counting from 0, modulo 2^32) sits at
+ * index n & (nrecords - 1). The driver publishes a record by storing
+ * head with release semantics; the reader loads head with acquire
+ * semantics, copies out the records from tail up to head and then
+ * stores tail with release semantics to give them back. If the reader
+ * falls behind and the ring fills up, new packets are dropped and
+ * counted in lost, and the next record that makes it carries
+ * WACOM_V_RING_LOST.
+ *
+ * This file is shared with userspace (see tools/wacom_v_rec.c), keep it
+ * free of anything the kernel does not export to it.
+ */
+
+#ifndef _WACOM_SERIAL5_RING_H
+#define _WACOM_SERIAL5_RING_H
+
+#include <linux/types.h>
+
+#define WACOM_V_RING_VERSION	1
+
+struct wacom_v_ring_header {
+	__u32 version;		/* WACOM_V_RING_VERSION */
+	__u32 nrecords;		/* a power of two */
+	__u32 record_size;	/* sizeof(struct wacom_v_ring_record) */
+	__u32 data_offset;	/* of record 0 from the start of the mapping */
+	__u32 head;		/* records written, by the driver */
+	__u32 tail;		/* records read, by the reader */
+	__u32 lost;		/* packets dropped, the ring was full */
+	__u32 reserved;
+};
+
+/* Record flags: bit n (see enum wacom_v_drop_reason) is set if the
+ * framer threw bytes away for that reason since the previous record. */
+#define WACOM_V_RING_LOST	0x80	/* packets dropped before this one */
+
+struct wacom_v_ring_record {
+	__s64 time;		/* arrival of the first byte, CLOCK_MONOTONIC ns */
+	__u8 data[9];		/* the packet as it came off the line */
+	__u8 channel;
+	__u8 flags;
+	__u8 reserved[5];
+};
+
+#endif /* _WACOM_SERIAL5_RING_H */
@@ -0,0 +1,134 @@
+/*
+ * Tracepoints for the Wacom protocol 5 driver
+ *
+ * Enable with eg.
+ *	echo 1 > /sys/kernel/tracing/events/wacom_serial5/enable
+ * or record them with "perf record -e 'wacom_serial5:*'".
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM wacom_serial5
+
+#if !defined(_WACOM_SERIAL5_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _WACOM_SERIAL5_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+#include "wacom_serial5_core.h"
+
+/* Every byte from the serial port, and what the framer made of it */
+TRACE_EVENT(wacom_v_rx,
+	TP_PROTO(unsigned char data, unsigned int flags, int result),
+	TP_ARGS(data, flags, result),
+
+	TP_STRUCT__entry(
+		__field(unsigned char, data)
+		__field(unsigned int, flags)
+		__field(int, result)
+	),
+
+	TP_fast_assign(
+		__entry->data = data;
+		__entry->flags = flags;
+		__entry->result = result;
+	),
+
+	TP_printk("data=0x%02x flags=0x%x result=%s", __entry->data,
+		  __entry->flags,
+		  __print_symbolic(__entry->result,
+				   { WACOM_V_NOTHING, "none" },
+				   { WACOM_V_PACKET, "packet" },
+				   { WACOM_V_RESPONSE, "response" }))
+);
+
+/* A packet was decoded. x, y and pressure are the values last reported
+ * for the channel, time is when the first byte of the packet arrived. */
+TRACE_EVENT(wacom_v_packet,
+	TP_PROTO(const unsigned char *data, const struct tool_state *state,
+		 int nevents, ktime_t time),
+	TP_ARGS(data, state, nevents, time),
+
+	TP_STRUCT__entry(
+		__field(unsigned char, header)
+		__field(int, channel)
+		__field(int, tool_id)
+		__field(int, x)
+		__field(int, y)
+		__field(int, pressure)
+		__field(int, nevents)
+		__field(s64, time)
+		__field(s64, latency)
+	),
+
+	TP_fast_assign(
+		__entry->header = data[0];
+		__entry->channel = state->channel;
+		__entry->tool_id = state->tool_id;
+		__entry->x = state->shadow.abs[ABS_X];
+		__entry->y = state->shadow.abs[ABS_Y];
+		__entry->pressure = state->shadow.abs[ABS_PRESSURE];
+		__entry->nevents = nevents;
+		__entry->time = ktime_to_ns(time);
+		__entry->latency = ktime_to_ns(ktime_sub(ktime_get(), time));
+	),
+
+	TP_printk("header=0x%02x channel=%d tool_id=0x%03x x=%d y=%d "
+		  "pressure=%d events=%d time=%lld latency=%lldns",
+		  __entry->header, __entry->channel, __entry->tool_id,
+		  __entry->x, __entry->y, __entry->pressure, __entry->nevents,
+		  __entry->time, __entry->latency)
+);
+
+/* A tool was identified by a device ID packet */
+TRACE_EVENT(wacom_v_device_id,
+	TP_PROTO(const struct tool_state *state),
+	TP_ARGS(state),
+
+	TP_STRUCT__entry(
+		__field(int, channel)
+		__field(int, tool_id)
+		__field(int, tool)
+		__field(u32, serial_num)
+	),
+
+	TP_fast_assign(
+		__entry->channel = state->channel;
+		__entry->tool_id = state->tool_id;
+		__entry->tool = state->tool;
+		__entry->serial_num = state->serial_num;
+	),
+
+	TP_printk("channel=%d tool_id=0x%03x tool=0x%x serial=0x%08x",
+		  __entry->channel, __entry->tool_id, __entry->tool,
+		  __entry->serial_num)
+);
+
+/* A tool left proximity and its state was reset */
+TRACE_EVENT(wacom_v_out_of_proximity,
+	TP_PROTO(const struct tool_state *state),
+	TP_ARGS(state),
+
+	TP_STRUCT__entry(
+		__field(int, channel)
+		__field(int, tool_id)
+		__field(int, tool)
+	),
+
+	TP_fast_assign(
+		__entry->channel = state->channel;
+		__entry->tool_id = state->tool_id;
+		__entry->tool = state->tool;
+	),
+
+	TP_printk("channel=%d tool_id=0x%03x tool=0x%x",
+		  __entry->channel, __entry->tool_id, __entry->tool)
+);
+
+#endif /* _WACOM_SERIAL5_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE wacom_serial5_trace
+#include <trace/define_trace.h>